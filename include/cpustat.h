@@ -0,0 +1,12 @@
+#ifndef _CPUSTAT_H_
+#define _CPUSTAT_H_
+#include "param.h"
+
+// Per-cpu statistics, filled in by getcpuinfo().
+struct cpustat {
+	int ncpu; 		// number of cpus running
+	uint ticks[NCPU]; 	// timer interrupts each cpu has taken
+	uint idleticks[NCPU]; 	// ...of which found it halted with nothing to run
+};
+
+#endif //_CPUSTAT_H_
@@ -9,22 +9,33 @@
 // Inodes start at block 2.
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+
+// Block size: a whole number of 512-byte disk sectors, up to a page.
+// Set with BSIZE in the Makefile; kernel and mkfs must agree.
+#ifndef BSIZE
+#define BSIZE 1024
+#endif
+#if BSIZE % 512 != 0 || BSIZE > 4096
+#error "BSIZE must be 512, 1024, 2048 or 4096"
+#endif
 
 // File system super block
 struct superblock {
   uint size;         // Size of file system image (blocks)
   uint nblocks;      // Number of data blocks
   uint ninodes;      // Number of inodes.
+  uint bsize;        // Block size (bytes); 0 on old images means 512
+  uint nlog;         // Number of log blocks, header included; 0 if none
+  uint logstart;     // Block number of first log block
 };
 
 #define NDIRECT 12
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT)  // without extents
 
 // On-disk inode structure
 struct dinode {
-  short type;           // File type
+  short type;           // File type, and DI_EXTENT
   short major;          // Major device number (T_DEV only)
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
@@ -32,6 +43,27 @@ struct dinode {
   uint addrs[NDIRECT+1];   // Data block addresses
 };
 
+// An inode with DI_EXTENT set in its type maps its blocks with
+// extents, runs of consecutive disk blocks, instead: addrs holds
+// NEXTENT of them and then the first of a chain of extent blocks
+// holding more.  The extents, in order, cover the file's blocks
+// from block 0; unused ones have len 0.
+#define DI_EXTENT 0x100
+#define NEXTENT   (NDIRECT / 2)
+
+struct extent {
+  uint start;           // First disk block
+  uint len;             // Number of blocks
+};
+
+#define NEXTBLK ((BSIZE - 2*sizeof(uint)) / sizeof(struct extent))
+
+struct extblock {
+  uint next;            // Next extent block, or 0
+  uint pad;
+  struct extent e[NEXTBLK];
+};
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -52,4 +84,42 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Directory entries per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A directory that outgrows DIRHASHMIN blocks is rebuilt as a hashed
+// directory.  Its block 0 holds a struct dirhead in slot 0 and then
+// "." and "..".  Blocks 1 through nbucket start the hash chains; a
+// name goes in chain 1 + dirhash(name) % nbucket.  The last slot of
+// each chain block is a struct dirnext naming the next block of the
+// chain, or 0.  These slots have inum 0, so a plain scan of the
+// dirents skips them, and directories without a dirhead are read
+// as a plain sequence of dirents.
+#define DIRHASHMIN  4
+#define DIRNBUCKET 16
+#define DIRMAGIC   "xv6dh"
+
+// Blocks that a create() converting its directory logs, at worst.
+// The new layout is block 0, DIRNBUCKET chain heads, and, if every
+// entry hashes to one chain, the extra blocks of that chain.  Add
+// the directory's inode block and extent block, two bitmap blocks
+// for its old and new blocks, and the new inode's block, first
+// directory block and bitmap block.  iinit checks that it fits in
+// one transaction (MAXOPBLOCKS) at every BSIZE.
+#define DIRCONVBLOCKS \
+  (1 + DIRNBUCKET + (DIRHASHMIN*DPB + DPB-2)/(DPB-1) - 1 + 2 + 2 + 3)
+
+struct dirhead {
+  ushort inum;          // always 0
+  char magic[6];        // DIRMAGIC
+  uint nbucket;         // number of hash chains
+  uint pad;
+};
+
+struct dirnext {
+  ushort inum;          // always 0
+  char pad[10];
+  uint next;            // next block of this chain, or 0
+};
+
 #endif // _FS_H_
@@ -8,8 +8,14 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NBUF         10  // size of disk block cache
-#define NINODE       50  // maximum number of active i-nodes
+#define MAXOPBLOCKS  32  // max # of blocks any FS op writes; covers
+                         // converting a directory to hashed
+                         // (DIRCONVBLOCKS in fs.h, 28 blocks)
+#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define BCACHEDIV    16  // disk block cache gets 1/BCACHEDIV of free memory
+#define NREADAHEAD   32  // most blocks read ahead of a sequential reader
+#define NINODE      200  // maximum number of cached i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define USERTOP  0xA0000 // end of user address space
@@ -2,11 +2,18 @@
 #define _PSTAT_H_
 #include "param.h"
 
+// Scheduling policies, reported in pstat.policy.
+#define SCHED_LOTTERY 0 	// random draw weighted by tickets
+#define SCHED_STRIDE  1 	// deterministic stride scheduling, tickets as weights
+
 struct pstat {
+	int policy; 		// the scheduling policy in use (SCHED_*)
 	int inuse[NPROC]; 	// BOOLEAN: is the PTE in use?
 	int tickets[NPROC]; 	// number of tickets the process has.
 	int pid[NPROC]; 	// the pid of the process.
 	int ticks[NPROC]; 	// Number of tickets each process has accumulated.
+	int faults[NPROC]; 	// page faults the process has taken (lazy heap + copy-on-write)
+	int resident[NPROC]; 	// pages of user memory actually backed by physical memory
 /*
  * Current assumption is that ticks is the overall amount of tickets
  * that a process has seen. tickets contains the current tickets of
@@ -26,5 +26,9 @@
 #define SYS_cluis  22
 #define SYS_settickets 23
 #define SYS_getpinfo 24
+#define SYS_getcpuinfo 25
+#define SYS_sleep_until 26
+#define SYS_sync   27
+#define SYS_fsync  28
 
 #endif // _SYSCALL_H_
@@ -37,6 +37,7 @@
 #define IRQ_COM1         4
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_WAKEUP      20      // IPI to get an idle cpu out of hlt
 #define IRQ_SPURIOUS    31
 
 #endif // _TRAPS_H_
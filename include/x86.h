@@ -11,6 +11,15 @@ inb(ushort port)
   return data;
 }
 
+static inline uint
+inl(ushort port)
+{
+  uint data;
+
+  asm volatile("in %1,%0" : "=a" (data) : "d" (port));
+  return data;
+}
+
 static inline void
 insl(int port, void *addr, int cnt)
 {
@@ -32,6 +41,12 @@ outw(ushort port, ushort data)
   asm volatile("out %0,%1" : : "a" (data), "d" (port));
 }
 
+static inline void
+outl(ushort port, uint data)
+{
+  asm volatile("out %0,%1" : : "a" (data), "d" (port));
+}
+
 static inline void
 outsl(int port, const void *addr, int cnt)
 {
@@ -41,6 +56,16 @@ outsl(int port, const void *addr, int cnt)
                "cc");
 }
 
+// Index of the lowest set bit in x, which must not be 0.
+static inline uint
+bsf(uint x)
+{
+  uint r;
+
+  asm("bsf %1,%0" : "=r" (r) : "rm" (x));
+  return r;
+}
+
 static inline void
 stosb(void *addr, int data, int cnt)
 {
@@ -126,6 +151,15 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and halt until the next one arrives.
+// sti takes effect only after the following instruction,
+// so no interrupt can be taken between the sti and the hlt.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt");
+}
+
 static inline uint
 xchg(volatile uint *addr, uint newval)
 {
@@ -1,138 +1,402 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 // 
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to flush it to disk.
+// * After changing buffer data, call bwrite to mark it for writing.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 // 
-// The implementation uses three state flags internally:
-// * B_BUSY: the block has been returned from bread
-//     and has not been passed back to brelse.  
+// A process holds a buffer between bread and brelse by holding
+// its sleep lock.  b->refcnt counts the processes holding or
+// waiting for the buffer; only buffers with no references are
+// recycled.
+//
+// The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been initialized
 //     with the associated disk block contents.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Writes are delayed: bwrite only marks the buffer dirty, so
+// repeated updates to a block cost one disk write.  Dirty buffers
+// are written by bsync, which the bflush kernel thread calls every
+// BFLUSHTICKS ticks, which bget calls when every idle buffer is
+// dirty, and which the sync and fsync system calls call.  Blocks
+// changed inside a log transaction are pinned (bpin) until it
+// commits, so bsync leaves them alone and they are never recycled.
+//
+// The cache gets 1/BCACHEDIV of free memory at boot, but at least
+// NBUF buffers.  Buffers hash by (dev, blockno) into NBUFHASH
+// buckets, each with its own lock and its own LRU list, so lookups
+// of different blocks do not contend.  A miss must take a buffer
+// from some bucket, possibly another one; bcache.lock serializes
+// misses, so only a miss ever holds two bucket locks at once.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "buf.h"
+#include "fs.h"
 
-struct {
+#define NBUFHASH 61
+#define BFLUSHTICKS 300  // period of the flusher thread
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
+  // Linked list of buffers in this bucket, through prev/next.
   // head.next is most recently used.
   struct buf head;
+};
+
+struct {
+  struct spinlock lock;  // serializes misses
+  int nbuf;
+  struct bucket bucket[NBUFHASH];
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUFHASH];
+}
+
+// Move b to the front (most recently used end) of bucket h.
+static void
+bfront(struct bucket *h, struct buf *b)
+{
+  b->next = h->head.next;
+  b->prev = &h->head;
+  h->head.next->prev = b;
+  h->head.next = b;
+}
+
 void
 binit(void)
 {
+  struct bucket *h;
   struct buf *b;
+  char *p, *data;
+  int i, n;
 
   initlock(&bcache.lock, "bcache");
+  for(h = bcache.bucket; h < bcache.bucket+NBUFHASH; h++){
+    initlock(&h->lock, "bcache.bucket");
+    h->head.prev = &h->head;
+    h->head.next = &h->head;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  // Carve buffer headers and block data out of whole pages, so that
+  // no block straddles a page, and deal the buffers out over the buckets.
+  n = kfreepages() / BCACHEDIV * (PGSIZE / BSIZE);
+  if(n < NBUF)
+    n = NBUF;
+  for(i = 0; i < n; i++){
+    if(i % (PGSIZE / sizeof(struct buf)) == 0 && (p = kalloc()) == 0)
+      break;
+    if(i % (PGSIZE / BSIZE) == 0 && (data = kalloc()) == 0)
+      break;
+    b = (struct buf*)p + i % (PGSIZE / sizeof(struct buf));
+    b->data = (uchar*)data + i % (PGSIZE / BSIZE) * BSIZE;
     b->dev = -1;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->blockno = 0;
+    b->flags = 0;
+    b->refcnt = 0;
+    b->lastuse = 0;
+    initsleeplock(&b->lock, "buffer");
+    bfront(&bcache.bucket[i % NBUFHASH], b);
   }
+  bcache.nbuf = i;
+  if(bcache.nbuf < NBUF)
+    panic("binit: no memory");
+  cprintf("bcache: %d buffers\n", bcache.nbuf);
 }
 
-// Look through buffer cache for sector on device dev.
+// Find a buffer for block blockno on device dev to recycle, the least
+// recently used clean one that nobody references.  It is moved into
+// bucket h and returned with one reference, or 0 if there is none.
+// Caller holds bcache.lock and h->lock.
+static struct buf*
+bvictim(struct bucket *h, uint dev, uint blockno)
+{
+  struct bucket *vh, *besth;
+  struct buf *b, *best;
+
+  best = 0;
+  besth = 0;
+  for(vh = bcache.bucket; vh < bcache.bucket+NBUFHASH; vh++){
+    if(vh != h)
+      acquire(&vh->lock);
+    for(b = vh->head.prev; b != &vh->head; b = b->prev){
+      if(b->refcnt == 0 && !(b->flags & B_DIRTY)){
+        if(best == 0 || (int)(b->lastuse - best->lastuse) < 0){
+          if(besth && besth != h && besth != vh)
+            release(&besth->lock);
+          best = b;
+          besth = vh;
+        }
+        break;
+      }
+    }
+    if(vh != h && vh != besth)
+      release(&vh->lock);
+  }
+  if(best == 0)
+    return 0;
+
+  best->dev = dev;
+  best->blockno = blockno;
+  best->flags = 0;
+  best->refcnt = 1;
+  best->lastuse = ticks;
+  best->next->prev = best->prev;
+  best->prev->next = best->next;
+  bfront(h, best);
+  if(besth != h)
+    release(&besth->lock);
+  return best;
+}
+
+// Look through buffer cache for block blockno on device dev.
 // If not found, allocate fresh block.
 // In either case, return locked buffer.
+// With nowait, return 0 instead if the block is already
+// cached or no buffer can be had without writing one out.
 static struct buf*
-bget(uint dev, uint sector)
+bget(uint dev, uint blockno, int nowait)
 {
+  struct bucket *h;
   struct buf *b;
+  int miss, flushed;
 
-  acquire(&bcache.lock);
+  h = bhash(dev, blockno);
+  miss = 0;
+  flushed = 0;
+  acquire(&h->lock);
 
  loop:
   // Try for cached block.
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->sector == sector){
-      if(!(b->flags & B_BUSY)){
-        b->flags |= B_BUSY;
-        release(&bcache.lock);
-        return b;
+  for(b = h->head.next; b != &h->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      if(nowait){
+        release(&h->lock);
+        if(miss)
+          release(&bcache.lock);
+        return 0;
       }
-      sleep(b, &bcache.lock);
-      goto loop;
+      b->refcnt++;
+      release(&h->lock);
+      if(miss)
+        release(&bcache.lock);
+      acquiresleep(&b->lock);
+      return b;
     }
   }
 
-  // Allocate fresh block.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if((b->flags & B_BUSY) == 0){
-      b->dev = dev;
-      b->sector = sector;
-      b->flags = B_BUSY;
-      release(&bcache.lock);
-      return b;
-    }
+  // Not cached.  Take bcache.lock, which must come before h->lock,
+  // and look again in case another miss brought the block in.
+  if(!miss){
+    release(&h->lock);
+    acquire(&bcache.lock);
+    acquire(&h->lock);
+    miss = 1;
+    goto loop;
+  }
+
+  // Allocate fresh block.  If every idle buffer is waiting
+  // to be written, write them all out and try again.
+  if((b = bvictim(h, dev, blockno)) == 0){
+    release(&h->lock);
+    release(&bcache.lock);
+    if(nowait)
+      return 0;
+    if(bsync(1) == 0 && flushed)
+      panic("bget: no buffers");
+    flushed = 1;
+    acquire(&h->lock);
+    miss = 0;
+    goto loop;
   }
-  panic("bget: no buffers");
+  release(&h->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
-// Return a B_BUSY buf with the contents of the indicated disk sector.
+// Return a locked buf with the contents of the indicated disk block.
 struct buf*
-bread(uint dev, uint sector)
+bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, sector);
+  b = bget(dev, blockno, 0);
   if(!(b->flags & B_VALID))
     iderw(b);
   return b;
 }
 
-// Write b's contents to disk.  Must be locked.
+// Start reading block blockno into the cache if it is not there,
+// without waiting for it.  The buffer stays locked until
+// the read completes and ideintr passes it to bdone.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bget(dev, blockno, 1)) == 0)
+    return;
+  b->flags |= B_ASYNC;
+  idesubmit(b);
+}
+
+// Return a locked buf for block blockno, whose contents the
+// caller is about to overwrite, without reading it from disk.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Start writing locked b to disk now and give it up: the disk
+// releases b when the write is done (see bdone).  To wait for
+// the write, pin b first and then bread it again, which sleeps
+// until the disk lets go of b.
+void
+bstart(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bstart");
+  b->flags |= B_DIRTY|B_ASYNC;
+  idesubmit(b);
+}
+
+// Keep b in the cache, where bsync and misses leave it alone,
+// until bunpin.  The log pins the blocks of a transaction
+// until it has written them to their home locations.
+void
+bpin(struct buf *b)
+{
+  struct bucket *h;
+
+  h = bhash(b->dev, b->blockno);
+  acquire(&h->lock);
+  b->refcnt++;
+  release(&h->lock);
+}
+
+void
+bunpin(struct buf *b)
+{
+  struct bucket *h;
+
+  h = bhash(b->dev, b->blockno);
+  acquire(&h->lock);
+  b->refcnt--;
+  release(&h->lock);
+}
+
+// Mark b's contents to be written to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
-  if((b->flags & B_BUSY) == 0)
+  if(!holdingsleep(&b->lock))
     panic("bwrite");
   b->flags |= B_DIRTY;
-  iderw(b);
 }
 
 // Release the buffer b.
 void
 brelse(struct buf *b)
 {
-  if((b->flags & B_BUSY) == 0)
+  struct bucket *h;
+
+  if(!holdingsleep(&b->lock))
     panic("brelse");
 
-  acquire(&bcache.lock);
+  releasesleep(&b->lock);
 
-  b->next->prev = b->prev;
-  b->prev->next = b->next;
-  b->next = bcache.head.next;
-  b->prev = &bcache.head;
-  bcache.head.next->prev = b;
-  bcache.head.next = b;
+  h = bhash(b->dev, b->blockno);
+  acquire(&h->lock);
+  if(--b->refcnt == 0){
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+    bfront(h, b);
+    b->lastuse = ticks;
+  }
+  release(&h->lock);
+}
+
+// Release b after an asynchronous disk request; called by ideintr.
+// This is not a use of b, so b keeps its place in the LRU list.
+void
+bdone(struct buf *b)
+{
+  struct bucket *h;
 
-  b->flags &= ~B_BUSY;
-  wakeup(b);
+  releasesleep(&b->lock);
 
-  release(&bcache.lock);
+  h = bhash(b->dev, b->blockno);
+  acquire(&h->lock);
+  b->refcnt--;
+  release(&h->lock);
 }
 
+
+// Start writing every dirty buffer that nobody is using to disk,
+// and if wait is set, wait for the disk to finish.
+// Returns the number of buffers written.
+int
+bsync(int wait)
+{
+  struct bucket *h;
+  struct buf *b;
+  int n;
+
+  n = 0;
+  for(h = bcache.bucket; h < bcache.bucket+NBUFHASH; h++){
+    acquire(&h->lock);
+    for(b = h->head.next; b != &h->head; b = b->next){
+      if(b->refcnt != 0 || !(b->flags & B_DIRTY))
+        continue;
+      // Nobody holds or waits for b, so this cannot sleep.
+      // The disk releases b when it is done (see bdone).
+      b->refcnt++;
+      acquiresleep(&b->lock);
+      b->flags |= B_ASYNC;
+      idesubmit(b);
+      n++;
+    }
+    release(&h->lock);
+  }
+  if(wait)
+    idedrain();
+  return n;
+}
+
+// Body of the flusher kernel thread.
+void
+bflush(void)
+{
+  for(;;){
+    acquire(&tickslock);
+    if(twsleep(ticks + BFLUSHTICKS) < 0)
+      proc->killed = 0;  // kernel threads do not die
+    release(&tickslock);
+    bsync(0);
+  }
+}
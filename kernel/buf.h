@@ -1,17 +1,22 @@
 #ifndef _BUF_H_
 #define _BUF_H_
+#include "sleeplock.h"
+
 // IO Buffer
 struct buf {
   int flags;
   uint dev;
-  uint sector;
+  uint blockno;
+  struct sleeplock lock; // held between bread and brelse
+  int refcnt; // processes holding or waiting for lock
   struct buf *prev; // LRU cache list
   struct buf *next;
   struct buf *qnext; // disk queue
-  uchar data[512];
+  uint lastuse;      // ticks at last brelse, to pick a victim
+  uchar *data;       // BSIZE bytes
 };
-#define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // nobody waits for the disk; release when done
 
 #endif // _BUF_H_
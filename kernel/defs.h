@@ -7,15 +7,26 @@ struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct sleeplock;
 struct spinlock;
 struct stat;
+struct superblock;
 struct pstat;
+struct cpustat;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bprefetch(uint, uint);
+void            bdone(struct buf*);
+struct buf*     bnew(uint, uint);
+void            bstart(struct buf*);
+void            bpin(struct buf*);
+void            bunpin(struct buf*);
+int             bsync(int);
+void            bflush(void);
 
 // console.c
 void            consoleinit(void);
@@ -38,6 +49,7 @@ int             filewrite(struct file*, char*, int n);
 // fs.c
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dset(struct inode*, char*, uint);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(void);
@@ -50,6 +62,8 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+void            readsb(uint, struct superblock*);
+void            ireadahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -57,6 +71,8 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idesubmit(struct buf*);
+void            idedrain(void);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -67,6 +83,11 @@ void            ioapicinit(void);
 char*           kalloc(void);
 void            kfree(char*);
 void            kinit(void);
+char*           kzalloc(void);
+int             kzfill(void);
+int             kfreepages(void);
+void            kref(char*);
+int             krefcount(char*);
 
 // kbd.c
 void            kbdintr(void);
@@ -76,15 +97,27 @@ int             cpunum(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(int);
+void            lapicipi(int, int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
+// log.c
+void            initlog(void);
+void            begin_op(void);
+void            end_op(void);
+void            log_write(struct buf*);
+
 // mp.c
 extern int      ismp;
 int             mpbcpu(void);
 void            mpinit(void);
 void            mpstartthem(void);
 
+// pci.c
+int             pcifind(int, int);
+uint            pciread(int, int);
+void            pciwrite(int, int, uint);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -107,15 +140,23 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kthread(char*, void(*)(void));
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
 int 		settickets(uint);
 int 		getpinfo(struct pstat*);
+int             getcpuinfo(struct cpustat*);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// sleeplock.c
+void            acquiresleep(struct sleeplock*);
+void            releasesleep(struct sleeplock*);
+int             holdingsleep(struct sleeplock*);
+void            initsleeplock(struct sleeplock*, char*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -151,6 +192,10 @@ extern uint     ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
 
+// twheel.c
+void            twtick(void);
+int             twsleep(uint);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
@@ -168,6 +213,9 @@ void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+int             cowcopy(pde_t*, uint);
+int             lazyalloc(pde_t*, uint, uint);
+int             uvmresident(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
@@ -67,8 +67,11 @@ fileclose(struct file *f)
   
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
-  else if(ff.type == FD_INODE)
+  else if(ff.type == FD_INODE){
+    begin_op();
     iput(ff.ip);
+    end_op();
+  }
 }
 
 // Get metadata about file f.
@@ -95,9 +98,20 @@ fileread(struct file *f, char *addr, int n)
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
+    // A read starting where the last one ended is sequential:
+    // read ahead, twice as far as last time, up to NREADAHEAD blocks.
+    if(f->off != f->raoff)
+      f->ra = 0;
+    else if(f->ra == 0)
+      f->ra = 4;
+    else if(f->ra < NREADAHEAD)
+      f->ra *= 2;
     ilock(f->ip);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
       f->off += r;
+    f->raoff = f->off;
+    if(f->ra)
+      ireadahead(f->ip, f->off, f->ra*BSIZE);
     iunlock(f->ip);
     return r;
   }
@@ -115,11 +129,30 @@ filewrite(struct file *f, char *addr, int n)
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = writei(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
-    return r;
+    // write a few blocks at a time to avoid exceeding
+    // the maximum log transaction size, including
+    // i-node, extent or indirect block, allocation blocks,
+    // and 2 blocks of slop for non-aligned writes.
+    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int i = 0;
+    while(i < n){
+      int n1 = n - i;
+      if(n1 > max)
+        n1 = max;
+
+      begin_op();
+      ilock(f->ip);
+      if((r = writei(f->ip, addr + i, f->off, n1)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+      end_op();
+
+      if(r > 0)
+        i += r;
+      if(r != n1)
+        break;  // error, or the file cannot grow any more
+    }
+    return i == 0 && n > 0 ? -1 : i;
   }
   panic("filewrite");
 }
@@ -1,5 +1,7 @@
 #ifndef _FILE_H_
 #define _FILE_H_
+#include "sleeplock.h"
+
 struct file {
   enum { FD_NONE, FD_PIPE, FD_INODE } type;
   int ref; // reference count
@@ -8,6 +10,8 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint raoff;  // where the last read ended
+  uint ra;     // blocks to read ahead; 0 unless reads are sequential
 };
 
 
@@ -17,7 +21,12 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
-  int flags;          // I_BUSY, I_VALID
+  struct sleeplock lock;  // Held while using metadata and contents
+  int flags;          // I_VALID, I_EXTENT
+  int hashed;         // In an icache hash chain
+  struct inode *hnext;  // Next in hash chain
+  struct inode *prev;   // Free list, when ref == 0
+  struct inode *next;
 
   short type;         // copy of disk inode
   short major;
@@ -27,8 +36,8 @@ struct inode {
   uint addrs[NDIRECT+1];
 };
 
-#define I_BUSY 0x1
-#define I_VALID 0x2
+#define I_VALID  0x2
+#define I_EXTENT 0x4  // addrs holds extents (DI_EXTENT)
 
 
 // device implementations
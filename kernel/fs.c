@@ -4,7 +4,8 @@
 //   + Directories: inode with special contents (list of other inodes!)
 //   + Names: paths like /usr/rtm/xv6/fs.c for convenient naming.
 //
-// Disk layout is: superblock, inodes, block in-use bitmap, data blocks.
+// Disk layout is: superblock, inodes, block in-use bitmap, log,
+// data blocks.
 //
 // This file contains the low-level file system manipulation 
 // routines.  The (higher-level) system call implementations
@@ -15,8 +16,10 @@
 #include "param.h"
 #include "stat.h"
 #include "mmu.h"
+#include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "buf.h"
 #include "fs.h"
 #include "file.h"
@@ -24,75 +27,196 @@
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
 
-// Read the super block.
-static void
-readsb(int dev, struct superblock *sb)
+// Mounted file systems.
+//
+// The first use of a device reads its superblock into a struct
+// mount, where it stays, together with layout numbers derived
+// from it.  Entries are never freed, so once m->valid is set the
+// entry can be used without holding mtable.lock.
+
+#define NMOUNT 2  // one per IDE disk
+
+struct mount {
+  uint dev;
+  int valid;              // sb and the rest have been filled in
+  struct superblock sb;
+  uint bmapstart;         // first block of free-block bitmap
+  uint nbmap;             // number of bitmap blocks
+  ushort *nfree;          // free blocks covered by each bitmap block
+  uint cursor;            // where the next balloc without a hint looks
+
+  struct spinlock ilock;  // protects imap and ihint
+  uint *imap;             // bit set for each free inode
+  uint ihint;             // no free inode in imap words before this
+};
+
+static struct {
+  struct sleeplock lock;  // held while setting up an entry
+  struct mount mount[NMOUNT];
+} mtable;
+
+// Read the superblock of dev from disk.
+void
+readsb(uint dev, struct superblock *sb)
 {
   struct buf *bp;
-  
+
   bp = bread(dev, 1);
   memmove(sb, bp->data, sizeof(*sb));
   brelse(bp);
 }
 
-// Zero a block.
+// Return the mount entry for dev, reading its superblock
+// on first use.
+static struct mount*
+getmount(uint dev)
+{
+  struct mount *m, *empty;
+  struct buf *bp;
+  struct dinode *dip;
+  uint i, b, inum;
+
+  for(m = mtable.mount; m < &mtable.mount[NMOUNT]; m++)
+    if(m->valid && m->dev == dev)
+      return m;
+
+  acquiresleep(&mtable.lock);
+  empty = 0;
+  for(m = mtable.mount; m < &mtable.mount[NMOUNT]; m++){
+    if(m->valid && m->dev == dev){
+      releasesleep(&mtable.lock);
+      return m;
+    }
+    if(empty == 0 && !m->valid)
+      empty = m;
+  }
+  if(empty == 0)
+    panic("getmount: too many devices");
+
+  m = empty;
+  m->dev = dev;
+  readsb(dev, &m->sb);
+  if((m->sb.bsize ? m->sb.bsize : 512) != BSIZE){
+    cprintf("dev %d: block size %d, kernel built for %d\n",
+            dev, m->sb.bsize ? m->sb.bsize : 512, BSIZE);
+    panic("getmount: block size");
+  }
+  m->bmapstart = BBLOCK(0, m->sb.ninodes);
+  m->cursor = 0;
+
+  // Count the free blocks under each bitmap block.
+  m->nbmap = (m->sb.size + BPB - 1) / BPB;
+  if(m->nbmap > PGSIZE / sizeof(m->nfree[0]) || (m->nfree = (ushort*)kalloc()) == 0)
+    panic("getmount: bitmap summary");
+  for(i = 0; i < m->nbmap; i++){
+    m->nfree[i] = 0;
+    bp = bread(dev, m->bmapstart + i);
+    for(b = 0; b < BPB && i*BPB + b < m->sb.size; b++)
+      if((bp->data[b/8] & (1 << (b%8))) == 0)
+        m->nfree[i]++;
+    brelse(bp);
+  }
+
+  // Note which inodes are free.
+  initlock(&m->ilock, "imap");
+  m->ihint = 0;
+  if(m->sb.ninodes > PGSIZE*8 || (m->imap = (uint*)kzalloc()) == 0)
+    panic("getmount: inode bitmap");
+  for(inum = 1; inum < m->sb.ninodes; inum += IPB - inum%IPB){
+    bp = bread(dev, IBLOCK(inum));
+    for(i = inum; i < m->sb.ninodes && i/IPB == inum/IPB; i++){
+      dip = (struct dinode*)bp->data + i%IPB;
+      if(dip->type == 0)
+        m->imap[i/32] |= 1 << (i%32);
+    }
+    brelse(bp);
+  }
+
+  __sync_synchronize();  // fill in m before marking it valid
+  m->valid = 1;
+  releasesleep(&mtable.lock);
+  return m;
+}
+
+// Zero a block.  Its old contents are not read.
 static void
 bzero(int dev, int bno)
 {
   struct buf *bp;
   
-  bp = bread(dev, bno);
+  bp = bnew(dev, bno);
   memset(bp->data, 0, BSIZE);
-  bwrite(bp);
+  log_write(bp);
   brelse(bp);
 }
 
 // Blocks. 
 
-// Allocate a disk block.
+// Allocate a zeroed disk block, the first free one after prev, or if
+// prev is 0, after the last block allocated on dev.  Passing a
+// file's previous block as prev keeps the file's blocks together.
+// Bitmap blocks with nothing free are skipped without reading
+// them, and the others are scanned a word at a time.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint prev)
 {
-  int b, bi, m;
+  uint b, i, bi, w, near, word, *map;
   struct buf *bp;
-  struct superblock sb;
-
-  bp = 0;
-  readsb(dev, &sb);
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb.ninodes));
-    for(bi = 0; bi < BPB; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use on disk.
-        bwrite(bp);
-        brelse(bp);
-        return b + bi;
-      }
+  struct mount *mp;
+
+  mp = getmount(dev);
+  near = prev + 1;
+  if(prev == 0 || near >= mp->sb.size)
+    near = mp->cursor;
+
+  // Visit every bitmap block, starting with near's; then look
+  // again at near's block for blocks before near.
+  for(i = 0; i <= mp->nbmap; i++){
+    bi = (near/BPB + i) % mp->nbmap;
+    if(mp->nfree[bi] == 0)
+      continue;
+    bp = bread(dev, mp->bmapstart + bi);
+    map = (uint*)bp->data;
+    for(w = (i == 0 ? near%BPB/32 : 0); w < BPB/32; w++){
+      word = map[w];
+      if(i == 0 && w == near%BPB/32)
+        word |= (1 << (near%32)) - 1;  // blocks before near
+      if(word == 0xffffffff)
+        continue;
+      b = bi*BPB + w*32 + bsf(~word);
+      if(b >= mp->sb.size)
+        break;
+      map[w] |= 1 << (b%32);  // Mark block in use on disk.
+      mp->nfree[bi]--;
+      mp->cursor = b + 1;
+      log_write(bp);
+      brelse(bp);
+      bzero(dev, b);
+      return b;
     }
     brelse(bp);
   }
   panic("balloc: out of blocks");
 }
 
-// Free a disk block.
+// Free a disk block.  Only the bitmap changes, so freeing
+// the blocks of a large file does not fill the log.
 static void
 bfree(int dev, uint b)
 {
   struct buf *bp;
-  struct superblock sb;
+  struct mount *mp;
   int bi, m;
 
-  bzero(dev, b);
-
-  readsb(dev, &sb);
-  bp = bread(dev, BBLOCK(b, sb.ninodes));
+  mp = getmount(dev);
+  bp = bread(dev, mp->bmapstart + b/BPB);
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;  // Mark block free on disk.
-  bwrite(bp);
+  mp->nfree[b/BPB]++;
+  log_write(bp);
   brelse(bp);
 }
 
@@ -115,10 +239,9 @@ bfree(int dev, uint b)
 //
 // Processes are only allowed to read and write inode
 // metadata and contents when holding the inode's lock,
-// represented by the I_BUSY flag in the in-memory copy.
-// Because inode locks are held during disk accesses, 
-// they are implemented using a flag rather than with
-// spin locks.  Callers are responsible for locking
+// ip->lock.  Because inode locks are held during disk
+// accesses, they are sleep locks rather than spin locks.
+// Callers are responsible for locking
 // inodes before passing them to routines in this file; leaving
 // this responsibility with the caller makes it possible for them
 // to create arbitrarily-sized atomic operations.
@@ -128,43 +251,126 @@ bfree(int dev, uint b)
 // return pointers to *unlocked* inodes.  It is the callers'
 // responsibility to lock them before using them.  A non-zero
 // ip->ref keeps these unlocked inodes in the cache.
+//
+// Inodes hash by (dev, inum) into NIHASH chains.  An inode whose
+// last reference is dropped stays in its chain, still valid, and
+// joins the free list, so a later iget of the same inode needs no
+// disk read.  A miss recycles the least recently released inode.
+
+#define NIHASH 31
 
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+
+  // Linked list of inodes with ref == 0, through prev/next.
+  // free.next is most recently released.
+  struct inode free;
 } icache;
 
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &icache.hash[(dev * 31 + inum) % NIHASH];
+}
+
+// Take ip off the free list.
+static void
+ifreeout(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// Put ip on the free list, at the most recently released end,
+// or at the other end if its contents are not worth keeping.
+static void
+ifreein(struct inode *ip, int keep)
+{
+  struct inode *at;
+
+  at = keep ? &icache.free : icache.free.prev;
+  ip->prev = at;
+  ip->next = at->next;
+  at->next->prev = ip;
+  at->next = ip;
+}
+
+static void dinit(void);
+static void dpurge(uint dev, uint dir);
+
 void
 iinit(void)
 {
+  struct inode *ip;
+
+  if(DIRCONVBLOCKS > MAXOPBLOCKS)
+    panic("iinit: directory conversion too big for the log");
   initlock(&icache.lock, "icache");
+  dinit();
+  initsleeplock(&mtable.lock, "mtable");
+  icache.free.prev = &icache.free;
+  icache.free.next = &icache.free;
+  for(ip = icache.inode; ip < icache.inode+NINODE; ip++){
+    initsleeplock(&ip->lock, "inode");
+    ifreein(ip, 1);
+  }
 }
 
 static struct inode* iget(uint dev, uint inum);
 
 // Allocate a new inode with the given type on device dev.
+// The mount entry's bitmap of free inodes says which one to try.
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  uint inum, w;
   struct buf *bp;
   struct dinode *dip;
-  struct superblock sb;
+  struct mount *mp;
+
+  mp = getmount(dev);
+  for(;;){
+    acquire(&mp->ilock);
+    for(w = mp->ihint; w*32 < mp->sb.ninodes && mp->imap[w] == 0; w++)
+      ;
+    mp->ihint = w;
+    if(w*32 >= mp->sb.ninodes){
+      release(&mp->ilock);
+      panic("ialloc: no inodes");
+    }
+    inum = w*32 + bsf(mp->imap[w]);
+    mp->imap[w] &= ~(1 << (inum%32));
+    release(&mp->ilock);
 
-  readsb(dev, &sb);
-  for(inum = 1; inum < sb.ninodes; inum++){  // loop over inode blocks
     bp = bread(dev, IBLOCK(inum));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
-      bwrite(bp);   // mark it allocated on the disk
+      if(type != T_DEV)
+        dip->type |= DI_EXTENT;
+      log_write(bp);   // mark it allocated on the disk
       brelse(bp);
       return iget(dev, inum);
     }
-    brelse(bp);
+    brelse(bp);  // in use after all; leave it marked so
   }
-  panic("ialloc: no inodes");
+}
+
+// Note that inode inum on dev, just freed on disk, is free.
+static void
+ifree(uint dev, uint inum)
+{
+  struct mount *mp;
+
+  mp = getmount(dev);
+  acquire(&mp->ilock);
+  mp->imap[inum/32] |= 1 << (inum%32);
+  if(inum/32 < mp->ihint)
+    mp->ihint = inum/32;
+  release(&mp->ilock);
 }
 
 // Copy inode, which has changed, from memory to disk.
@@ -177,12 +383,14 @@ iupdate(struct inode *ip)
   bp = bread(ip->dev, IBLOCK(ip->inum));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
+  if(ip->type && (ip->flags & I_EXTENT))
+    dip->type |= DI_EXTENT;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
-  bwrite(bp);
+  log_write(bp);
   brelse(bp);
 }
 
@@ -191,27 +399,35 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Try for cached inode.
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = *ihash(dev, inum); ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        ifreeout(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Allocate fresh inode.
-  if(empty == 0)
+  // Recycle the least recently released inode.
+  ip = icache.free.prev;
+  if(ip == &icache.free)
     panic("iget: no inodes");
+  ifreeout(ip);
+  if(ip->hashed){
+    for(pp = ihash(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
+  pp = ihash(dev, inum);
+  ip->hnext = *pp;
+  *pp = ip;
+  ip->hashed = 1;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
@@ -242,16 +458,14 @@ ilock(struct inode *ip)
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
-  acquire(&icache.lock);
-  while(ip->flags & I_BUSY)
-    sleep(ip, &icache.lock);
-  ip->flags |= I_BUSY;
-  release(&icache.lock);
+  acquiresleep(&ip->lock);
 
   if(!(ip->flags & I_VALID)){
     bp = bread(ip->dev, IBLOCK(ip->inum));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
-    ip->type = dip->type;
+    ip->type = dip->type & ~DI_EXTENT;
+    if(dip->type & DI_EXTENT)
+      ip->flags |= I_EXTENT;
     ip->major = dip->major;
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
@@ -268,13 +482,10 @@ ilock(struct inode *ip)
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !(ip->flags & I_BUSY) || ip->ref < 1)
+  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
-  acquire(&icache.lock);
-  ip->flags &= ~I_BUSY;
-  wakeup(ip);
-  release(&icache.lock);
+  releasesleep(&ip->lock);
 }
 
 // Caller holds reference to unlocked ip.  Drop reference.
@@ -284,18 +495,23 @@ iput(struct inode *ip)
   acquire(&icache.lock);
   if(ip->ref == 1 && (ip->flags & I_VALID) && ip->nlink == 0){
     // inode is no longer used: truncate and free inode.
-    if(ip->flags & I_BUSY)
+    // ref == 1 means nobody else can hold or want the lock.
+    if(ip->lock.locked)
       panic("iput busy");
-    ip->flags |= I_BUSY;
     release(&icache.lock);
+    acquiresleep(&ip->lock);
     itrunc(ip);
+    if(ip->type == T_DIR)
+      dpurge(ip->dev, ip->inum);
     ip->type = 0;
     iupdate(ip);
+    ifree(ip->dev, ip->inum);
+    releasesleep(&ip->lock);
     acquire(&icache.lock);
     ip->flags = 0;
-    wakeup(ip);
   }
-  ip->ref--;
+  if(--ip->ref == 0)
+    ifreein(ip, ip->flags & I_VALID);
   release(&icache.lock);
 }
 
@@ -312,19 +528,110 @@ iunlockput(struct inode *ip)
 // The contents (data) associated with each inode is stored
 // in a sequence of blocks on the disk.  The first NDIRECT blocks
 // are listed in ip->addrs[].  The next NINDIRECT blocks are 
-// listed in the block ip->addrs[NDIRECT].
+// listed in the block ip->addrs[NDIRECT].  An inode with
+// I_EXTENT set lists extents instead; see fs.h.
 
-// Return the disk block address of the nth block in inode ip.
+// Count how many of the n block addresses at a are consecutive.
+static uint
+arun(uint *a, uint n)
+{
+  uint i;
+
+  for(i = 1; i < n && a[i] == a[0] + i; i++)
+    ;
+  return i;
+}
+
+// bmap for an inode with extents.  Blocks are only ever added at
+// the end of a file, so a block that is not mapped yet is the one
+// after the last extent: it extends that extent when the allocator
+// places it right after, or else starts a new one.
+static uint
+ebmap(struct inode *ip, uint bn, uint *run)
+{
+  uint base, addr, near, *link;
+  int i, n;
+  struct buf *bp, *nbp;
+  struct extent *e;
+  struct extblock *xb;
+
+  base = 0;
+  near = 0;
+  addr = 0;
+  bp = 0;
+  e = (struct extent*)ip->addrs;
+  n = NEXTENT;
+  link = &ip->addrs[NDIRECT];
+  for(;;){
+    for(i = 0; i < n && e[i].len; i++){
+      if(bn < base + e[i].len){
+        addr = e[i].start + bn - base;
+        *run = base + e[i].len - bn;
+        if(bp)
+          brelse(bp);
+        return addr;
+      }
+      base += e[i].len;
+      near = e[i].start + e[i].len - 1;
+    }
+    if(i < n || *link == 0){
+      // bn is past the last block mapped.
+      if(bn != base)
+        panic("bmap: hole");
+      if(addr == 0)
+        addr = balloc(ip->dev, near);
+      if(i > 0 && addr == e[i-1].start + e[i-1].len){
+        e[i-1].len++;
+        break;
+      }
+      if(i < n){
+        e[i].start = addr;
+        e[i].len = 1;
+        break;
+      }
+      // This list of extents is full: start an extent block.
+      *link = balloc(ip->dev, 0);
+      if(bp)
+        log_write(bp);
+      nbp = bread(ip->dev, *link);
+      memset(nbp->data, 0, BSIZE);
+    } else
+      nbp = bread(ip->dev, *link);
+    if(bp)
+      brelse(bp);
+    bp = nbp;
+    xb = (struct extblock*)bp->data;
+    e = xb->e;
+    n = NEXTBLK;
+    link = &xb->next;
+  }
+
+  if(bp){
+    log_write(bp);
+    brelse(bp);
+  }
+  *run = 1;
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip,
+// and set *run to the number of blocks from there on that are
+// consecutive on disk.
 // If there is no such block, bmap allocates one.
 static uint
-bmap(struct inode *ip, uint bn)
+bmaprun(struct inode *ip, uint bn, uint *run)
 {
   uint addr, *a;
   struct buf *bp;
 
+  if(ip->flags & I_EXTENT)
+    return ebmap(ip, bn, run);
+
+  // New blocks go right after the block before them, if possible.
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip->dev, bn > 0 ? ip->addrs[bn-1] : 0);
+    *run = arun(&ip->addrs[bn], NDIRECT - bn);
     return addr;
   }
   bn -= NDIRECT;
@@ -332,13 +639,14 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = balloc(ip->dev, ip->addrs[NDIRECT-1]);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      bwrite(bp);
+      a[bn] = addr = balloc(ip->dev, bn > 0 ? a[bn-1] : ip->addrs[NDIRECT]);
+      log_write(bp);
     }
+    *run = arun(&a[bn], NINDIRECT - bn);
     brelse(bp);
     return addr;
   }
@@ -346,6 +654,26 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+static uint
+bmap(struct inode *ip, uint bn)
+{
+  uint run;
+
+  return bmaprun(ip, bn, &run);
+}
+
+// Free the blocks of the n extents at e.
+static void
+efree(uint dev, struct extent *e, int n)
+{
+  int i;
+  uint j;
+
+  for(i = 0; i < n && e[i].len; i++)
+    for(j = 0; j < e[i].len; j++)
+      bfree(dev, e[i].start + j);
+}
+
 // Truncate inode (discard contents).
 // Only called after the last dirent referring
 // to this inode has been erased on disk.
@@ -354,7 +682,25 @@ itrunc(struct inode *ip)
 {
   int i, j;
   struct buf *bp;
-  uint *a;
+  uint *a, link, next;
+  struct extblock *xb;
+
+  if(ip->flags & I_EXTENT){
+    efree(ip->dev, (struct extent*)ip->addrs, NEXTENT);
+    for(link = ip->addrs[NDIRECT]; link; ){
+      bp = bread(ip->dev, link);
+      xb = (struct extblock*)bp->data;
+      efree(ip->dev, xb->e, NEXTBLK);
+      next = xb->next;
+      brelse(bp);  // bfree reads the block again
+      bfree(ip->dev, link);
+      link = next;
+    }
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -394,7 +740,7 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, run;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -408,20 +754,48 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  run = 0;
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if(run == 0)
+      addr = bmaprun(ip, off/BSIZE, &run);
+    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
+    if((off + m) % BSIZE == 0){
+      addr++;
+      run--;
+    }
   }
   return n;
 }
 
+// Start reading the blocks that hold bytes [off, off+n) of ip
+// into the buffer cache, without waiting for them.
+// Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, addr, run;
+
+  if(ip->type == T_DEV || off >= ip->size)
+    return;
+  if(off + n > ip->size || off + n < off)
+    n = ip->size - off;
+  run = 0;
+  for(bn = off/BSIZE; bn*BSIZE < off + n; bn++){
+    if(run == 0)
+      addr = bmaprun(ip, bn, &run);
+    bprefetch(ip->dev, addr++);
+    run--;
+  }
+}
+
 // Write data to inode.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, run;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -432,15 +806,22 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(!(ip->flags & I_EXTENT) && off + n > MAXFILE*BSIZE)
     n = MAXFILE*BSIZE - off;
 
+  run = 0;
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if(run == 0)
+      addr = bmaprun(ip, off/BSIZE, &run);
+    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
-    bwrite(bp);
+    log_write(bp);
     brelse(bp);
+    if((off + m) % BSIZE == 0){
+      addr++;
+      run--;
+    }
   }
 
   if(n > 0 && off > ip->size){
@@ -458,45 +839,421 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name cache.
+//
+// The dcache maps (dev, directory inum, name) to the inum that the
+// name refers to, or to 0 if the directory has no such entry, so
+// namex can resolve a cached path element without locking or
+// reading the directory.  An entry is only set while its directory
+// is locked, by the lookup that found it or by the change to the
+// directory, and dget does the iget of the result under dcache.lock,
+// so a change to the directory cannot slip in between.
+
+#define NDENTRY 256
+#define NDHASH  61
+
+struct dentry {
+  uint dev;
+  uint dir;              // inum of the directory; 0 if unused
+  char name[DIRSIZ];
+  uint inum;             // 0 for a negative entry
+  struct dentry *hnext;  // next in hash chain
+  struct dentry *prev;   // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+
+  // Linked list of all entries, through prev/next.
+  // lru.next is most recently used.
+  struct dentry lru;
+} dcache;
+
+static void
+dinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.lru.prev = &dcache.lru;
+  dcache.lru.next = &dcache.lru;
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    d->next = dcache.lru.next;
+    d->prev = &dcache.lru;
+    dcache.lru.next->prev = d;
+    dcache.lru.next = d;
+  }
+}
+
+static struct dentry**
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return &dcache.hash[h % NDHASH];
+}
+
+// Move d to the front of the LRU list.
+static void
+dfront(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.lru.next;
+  d->prev = &dcache.lru;
+  dcache.lru.next->prev = d;
+  dcache.lru.next = d;
+}
+
+// Take d out of its hash chain.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dhash(d->dev, d->dir, d->name); *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->dir = 0;
+}
+
+// Find the entry for name in directory dp.
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dhash(dp->dev, dp->inum, name); d; d = d->hnext)
+    if(d->dir == dp->inum && d->dev == dp->dev && namecmp(name, d->name) == 0)
+      return d;
+  return 0;
+}
+
+// Look up name in directory dp in the dcache.
+// If cached, set *ipp to the inode it names, or to 0
+// if the directory has no such entry, and return 1.
+// dp need not be locked.
+static int
+dget(struct inode *dp, char *name, struct inode **ipp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  dfront(d);
+  *ipp = d->inum ? iget(dp->dev, d->inum) : 0;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp refers to inum,
+// or that dp has no entry name if inum is 0.
+// Caller must hold dp's lock.
+void
+dset(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d, **pp;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp, name)) == 0){
+    d = dcache.lru.prev;
+    if(d->dir)
+      dunhash(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    pp = dhash(d->dev, d->dir, d->name);
+    d->hnext = *pp;
+    *pp = d;
+  }
+  d->inum = inum;
+  dfront(d);
+  release(&dcache.lock);
+}
+
+// Forget the entries of directory dir on dev, which is being freed.
+static void
+dpurge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++)
+    if(d->dir == dir && d->dev == dev)
+      dunhash(d);
+  release(&dcache.lock);
+}
+
+// Hash of a directory entry name; see fs.h.
+// tools/mkfs.c must compute the same.
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 0;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + (uchar)name[i];
+  return h;
+}
+
+// Return the number of hash chains of the directory
+// whose block 0 is in bp, or 0 if it is not hashed.
+static uint
+dirbuckets(struct buf *bp)
+{
+  struct dirhead *dh;
+
+  dh = (struct dirhead*)bp->data;
+  if(dh->inum != 0 || memcmp(dh->magic, DIRMAGIC, sizeof(dh->magic)) != 0)
+    return 0;
+  return dh->nbucket;
+}
+
+// Return the number of slots of block bn of directory dp that
+// hold entries: a chain block's last slot is its link.
+static int
+dirslots(struct inode *dp, uint bn, uint nbucket)
+{
+  if(nbucket)
+    return bn == 0 ? DPB : DPB-1;
+  return min(DPB, (dp->size - bn*BSIZE) / sizeof(struct dirent));
+}
+
+// Return the block of directory dp to search for name
+// after block bn, whose buffer is bp, or 0 if there is none.
+static uint
+dirnextblock(struct inode *dp, struct buf *bp, uint bn, uint nbucket, char *name)
+{
+  if(nbucket == 0)
+    return (bn+1)*BSIZE < dp->size ? bn+1 : 0;
+  if(bn == 0)
+    return 1 + dirhash(name) % nbucket;
+  return ((struct dirnext*)bp->data + DPB-1)->next;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 // Caller must have already locked dp.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint bn, inum, nbucket;
+  int i, n;
   struct buf *bp;
   struct dirent *de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
+  if(dp->size == 0)
+    return 0;
 
-  for(off = 0; off < dp->size; off += BSIZE){
-    bp = bread(dp->dev, bmap(dp, off / BSIZE));
-    for(de = (struct dirent*)bp->data;
-        de < (struct dirent*)(bp->data + BSIZE);
-        de++){
-      if(de->inum == 0)
+  // A hashed directory has only "." and ".." in block 0,
+  // and then the one chain that name hashes to.
+  bn = 0;
+  bp = bread(dp->dev, bmap(dp, 0));
+  nbucket = dirbuckets(bp);
+  for(;;){
+    de = (struct dirent*)bp->data;
+    n = dirslots(dp, bn, nbucket);
+    for(i = 0; i < n; i++){
+      if(de[i].inum == 0)
         continue;
-      if(namecmp(name, de->name) == 0){
+      if(namecmp(name, de[i].name) == 0){
         // entry matches path element
         if(poff)
-          *poff = off + (uchar*)de - bp->data;
-        inum = de->inum;
+          *poff = bn*BSIZE + i*sizeof(*de);
+        inum = de[i].inum;
         brelse(bp);
         return iget(dp->dev, inum);
       }
     }
+    bn = dirnextblock(dp, bp, bn, nbucket, name);
     brelse(bp);
+    if(bn == 0)
+      return 0;
+    bp = bread(dp->dev, bmap(dp, bn));
   }
-  return 0;
+}
+
+// Append an empty chain block to hashed directory dp
+// and return its block number.
+static uint
+dirgrow(struct inode *dp)
+{
+  uint bn;
+  struct buf *bp;
+
+  bn = dp->size / BSIZE;
+  bp = bread(dp->dev, bmap(dp, bn));
+  memset(bp->data, 0, BSIZE);
+  log_write(bp);
+  brelse(bp);
+  dp->size += BSIZE;
+  iupdate(dp);
+  return bn;
+}
+
+// Put the entry (name, inum) in its chain of hashed directory dp,
+// growing the chain if every block of it is full.
+static void
+dirhashlink(struct inode *dp, uint nbucket, char *name, uint inum)
+{
+  uint bn;
+  int i;
+  struct buf *bp;
+  struct dirent *de;
+  struct dirnext *dn;
+
+  bn = 1 + dirhash(name) % nbucket;
+  for(;;){
+    bp = bread(dp->dev, bmap(dp, bn));
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < DPB-1; i++){
+      if(de[i].inum == 0){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(bp);
+        brelse(bp);
+        return;
+      }
+    }
+    dn = (struct dirnext*)&de[DPB-1];
+    if(dn->next == 0){
+      dn->next = dirgrow(dp);
+      log_write(bp);
+    }
+    bn = dn->next;
+    brelse(bp);
+  }
+}
+
+// Rebuild linear directory dp, which is full, as a hashed directory.
+// The old entries are staged in up to DIRSTAGE pages, enough for a
+// directory of DIRHASHMIN blocks; bigger linear directories left by
+// older kernels stay linear.
+#define DIRSTAGE ((DIRHASHMIN*BSIZE + PGSIZE - 1) / PGSIZE)
+
+static void
+dirconvert(struct inode *dp)
+{
+  char *pg[DIRSTAGE];
+  uint n, m;
+  struct buf *bp;
+  struct dirent *de, *de0;
+  struct dirhead *dh;
+  int i, np;
+
+  n = dp->size;
+  np = (n + PGSIZE - 1) / PGSIZE;
+  if(np > DIRSTAGE)
+    return;
+  for(i = 0; i < np; i++){
+    if((pg[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(pg[i]);
+      return;
+    }
+    m = min(n - i*PGSIZE, PGSIZE);
+    if(readi(dp, pg[i], i*PGSIZE, m) != m)
+      panic("dirconvert read");
+  }
+  itrunc(dp);
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  memset(bp->data, 0, BSIZE);
+  dh = (struct dirhead*)bp->data;
+  memmove(dh->magic, DIRMAGIC, sizeof(dh->magic));
+  dh->nbucket = DIRNBUCKET;
+  de0 = (struct dirent*)bp->data;
+  for(i = 0; i < np; i++){
+    m = min(n - i*PGSIZE, PGSIZE);
+    for(de = (struct dirent*)pg[i]; de < (struct dirent*)(pg[i]+m); de++){
+      if(de->inum == 0)
+        continue;
+      if(namecmp(de->name, ".") == 0)
+        de0[1] = *de;
+      else if(namecmp(de->name, "..") == 0)
+        de0[2] = *de;
+    }
+  }
+  log_write(bp);
+  brelse(bp);
+  dp->size = BSIZE;
+  for(i = 0; i < DIRNBUCKET; i++)
+    dirgrow(dp);
+
+  for(i = 0; i < np; i++){
+    m = min(n - i*PGSIZE, PGSIZE);
+    for(de = (struct dirent*)pg[i]; de < (struct dirent*)(pg[i]+m); de++){
+      if(de->inum == 0 || namecmp(de->name, ".") == 0 || namecmp(de->name, "..") == 0)
+        continue;
+      dirhashlink(dp, DIRNBUCKET, de->name, de->inum);
+    }
+    kfree(pg[i]);
+  }
+}
+
+// Return the number of hash chains of directory dp, or 0.
+static uint
+dirnbucket(struct inode *dp)
+{
+  struct buf *bp;
+  uint n;
+
+  if(dp->size == 0)
+    return 0;
+  bp = bread(dp->dev, bmap(dp, 0));
+  n = dirbuckets(bp);
+  brelse(bp);
+  return n;
+}
+
+// Put (name, inum) in an empty slot of linear directory dp,
+// looking a block at a time.  Return -1 if there is none.
+static int
+dirfill(struct inode *dp, char *name, uint inum)
+{
+  uint bn;
+  int i, n;
+  struct buf *bp;
+  struct dirent *de;
+
+  for(bn = 0; bn*BSIZE < dp->size; bn++){
+    bp = bread(dp->dev, bmap(dp, bn));
+    de = (struct dirent*)bp->data;
+    n = dirslots(dp, bn, 0);
+    for(i = 0; i < n; i++){
+      if(de[i].inum == 0){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(bp);
+        brelse(bp);
+        return 0;
+      }
+    }
+    brelse(bp);
+  }
+  return -1;
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  uint nbucket;
   struct dirent de;
   struct inode *ip;
 
@@ -506,18 +1263,23 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  nbucket = dirnbucket(dp);
+  if(nbucket == 0 && dirfill(dp, name, inum) < 0){
+    // Full: convert a big directory, or else append the entry.
+    if(dp->size >= DIRHASHMIN*BSIZE){
+      dirconvert(dp);
+      nbucket = dirnbucket(dp);
+    }
+    if(nbucket == 0){
+      strncpy(de.name, name, DIRSIZ);
+      de.inum = inum;
+      if(writei(dp, (char*)&de, dp->size, sizeof(de)) != sizeof(de))
+        panic("dirlink");
+    }
   }
-
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
+  if(nbucket)
+    dirhashlink(dp, nbucket, name, inum);
+  dset(dp, name, inum);
   
   return 0;
 }
@@ -575,6 +1337,13 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(proc->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    if(!(nameiparent && *path == '\0') && dget(ip, name, &next)){
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = next;
+      continue;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -586,9 +1355,11 @@ namex(char *path, int nameiparent, char *name)
       return ip;
     }
     if((next = dirlookup(ip, name, 0)) == 0){
+      dset(ip, name, 0);
       iunlockput(ip);
       return 0;
     }
+    dset(ip, name, next->inum);
     iunlockput(ip);
     ip = next;
   }
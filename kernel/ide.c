@@ -1,4 +1,22 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code.
+//
+// Data moves by bus-master DMA when the PCI IDE controller and the
+// disk support it, so the CPU never copies it; otherwise by PIO,
+// with insl/outsl.  A disk that reports a DMA error drops back to PIO.
+//
+// A buf holds one file system block of BSIZE bytes, which is SPB
+// consecutive 512-byte sectors on the disk.
+//
+// Requests wait in idequeue in elevator (C-LOOK) order: ascending
+// block order from the current head position, wrapping around to
+// the lowest block once nothing lies ahead.  When the disk goes
+// idle, idestart takes the first request together with those right
+// behind it for consecutive blocks in the same direction, and
+// moves them all with one READ/WRITE DMA or MULTIPLE command.
+//
+// Callers either wait for a request (iderw) or submit it and go on
+// (idesubmit, with B_ASYNC set); ideintr passes completed asynchronous
+// requests to bdone.
 
 #include "types.h"
 #include "defs.h"
@@ -9,6 +27,7 @@
 #include "traps.h"
 #include "spinlock.h"
 #include "buf.h"
+#include "fs.h"
 
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
@@ -17,15 +36,57 @@
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
+#define IDE_CMD_RDMUL 0xc4
+#define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+#define IDE_CMD_IDENTIFY 0xec
 
-// idequeue points to the buf now being read/written to the disk.
+#define SECTSIZE      512
+#define SPB           (BSIZE / SECTSIZE)  // sectors per block
+
+#define IDE_MAXMULT   16    // most sectors moved by one PIO command
+#define IDE_MAXDMA    32    // most blocks moved by one DMA command (<= 256 sectors)
+
+// Bus-master DMA registers, relative to idebm.
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+
+#define BM_START      0x01  // BM_CMD: start transfer
+#define BM_READ       0x08  // BM_CMD: transfer from disk to memory
+#define BM_ERR        0x02  // BM_STATUS: error; write 1 to clear
+#define BM_INTR       0x04  // BM_STATUS: interrupt; write 1 to clear
+
+// Physical region descriptor: one buffer of a DMA transfer.
+struct prd {
+  uint addr;
+  ushort count;     // bytes
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last descriptor
+
+// The table must not cross a 64K boundary.
+static struct prd prdt[IDE_MAXDMA] __attribute__((aligned(sizeof(struct prd) * IDE_MAXDMA)));
+
+// idequeue points to the buf now being read/written to the disk,
+// the first of a batch for consecutive blocks that ends at idelast.
 // idequeue->qnext points to the next buf to be processed.
+// idetail points to the last buf in the queue.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *idetail;
+static struct buf *idelast;
+static uint idepos;   // where the disk head is going: last block of the batch
 
 static int havedisk1;
+static int idemult[2];  // sectors per READ/WRITE MULTIPLE, per disk
+static int idedma[2];   // does the disk use DMA?
+static ushort idebm;    // bus-master DMA I/O base, 0 if none
+static int idedmabusy;  // is the batch at the head moving by DMA?
 static void idestart(struct buf*);
 
 // Wait for IDE disk to become ready.
@@ -34,23 +95,65 @@ idewait(int checkerr)
 {
   int r;
 
-  while(((r = inb(0x1f7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY) 
+  while(((r = inb(0x1f7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
     ;
   if(checkerr && (r & (IDE_DF|IDE_ERR)) != 0)
     return -1;
   return 0;
 }
 
+// Find out how to talk to the selected disk d: whether it can
+// use DMA, and how many sectors to move per READ/WRITE MULTIPLE
+// (1 if the disk does not support multiple-sector commands).
+static void
+ideprobe(int d)
+{
+  ushort id[256];
+  int n;
+
+  idemult[d] = 1;
+  outb(0x1f7, IDE_CMD_IDENTIFY);
+  if(idewait(1) >= 0){
+    insl(0x1f0, id, SECTSIZE/4);
+
+    // Word 49 bit 8: DMA supported.
+    idedma[d] = idebm != 0 && (id[49] & (1<<8)) != 0;
+
+    // Word 47: most sectors per READ/WRITE MULTIPLE.
+    for(n = IDE_MAXMULT; n > 1 && n > (id[47] & 0xff); n /= 2)
+      ;
+    if(n > 1){
+      outb(0x1f2, n);
+      outb(0x1f7, IDE_CMD_SETMUL);
+      if(idewait(1) >= 0)
+        idemult[d] = n;
+    }
+  }
+
+  // By PIO a block must come in one piece, with one interrupt.
+  if(!idedma[d] && idemult[d] < SPB)
+    panic("ideprobe: disk cannot move a whole block");
+}
+
 void
 ideinit(void)
 {
-  int i;
+  int i, tag;
 
   initlock(&idelock, "ide");
   picenable(IRQ_IDE);
   ioapicenable(IRQ_IDE, ncpu - 1);
+  outb(0x3f6, 2);  // no interrupts while we poll
   idewait(0);
-  
+
+  // Find the bus-master registers of a PCI IDE controller
+  // (class 1, subclass 1) that can do DMA (prog-if bit 7), in BAR4,
+  // and let the controller master the bus.
+  if((tag = pcifind(0x01, 0x01)) >= 0 && (pciread(tag, 0x08) & 0x8000)){
+    idebm = pciread(tag, 0x20) & 0xfffc;
+    pciwrite(tag, 0x04, (pciread(tag, 0x04) & 0xffff) | 0x5);
+  }
+
   // Check if disk 1 is present
   outb(0x1f6, 0xe0 | (1<<4));
   for(i=0; i<1000; i++){
@@ -59,91 +162,215 @@ ideinit(void)
       break;
     }
   }
-  
+  if(havedisk1)
+    ideprobe(1);
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+  ideprobe(0);
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for b and the bufs behind it in the queue
+// that continue it.  Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *x;
+  int i, n, max;
+  uint sector;
+
   if(b == 0)
     panic("idestart");
 
+  max = idedma[b->dev&1] ? IDE_MAXDMA : idemult[b->dev&1] / SPB;
+  n = 1;
+  for(x = b; n < max && x->qnext != 0; x = x->qnext, n++){
+    if(x->qnext->dev != b->dev || x->qnext->blockno != x->blockno + 1 ||
+       (x->qnext->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+  }
+  idelast = x;
+  idepos = (b->dev&1)<<28 | x->blockno;
+
+  idedmabusy = idedma[b->dev&1];
+  if(idedmabusy){
+    // Point the controller at the buffers.
+    for(i = 0, x = b; i < n; i++, x = x->qnext){
+      prdt[i].addr = PADDR(x->data);
+      prdt[i].count = BSIZE;
+      prdt[i].flags = 0;
+    }
+    prdt[n-1].flags = PRD_EOT;
+    outl(idebm + BM_PRDT, PADDR(prdt));
+    outb(idebm + BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_READ);
+    outb(idebm + BM_STATUS, BM_ERR|BM_INTR);
+  }
+
+  sector = b->blockno * SPB;
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, 1);  // number of sectors
-  outb(0x1f3, b->sector & 0xff);
-  outb(0x1f4, (b->sector >> 8) & 0xff);
-  outb(0x1f5, (b->sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((b->sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, IDE_CMD_WRITE);
-    outsl(0x1f0, b->data, 512/4);
+  outb(0x1f2, n * SPB);  // number of sectors; 0 means 256
+  outb(0x1f3, sector & 0xff);
+  outb(0x1f4, (sector >> 8) & 0xff);
+  outb(0x1f5, (sector >> 16) & 0xff);
+  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
+  if(idedmabusy){
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm + BM_CMD, ((b->flags & B_DIRTY) ? 0 : BM_READ) | BM_START);
+  } else if(b->flags & B_DIRTY){
+    outb(0x1f7, n * SPB > 1 ? IDE_CMD_WRMUL : IDE_CMD_WRITE);
+    for(x = b; n-- > 0; x = x->qnext)
+      outsl(0x1f0, x->data, BSIZE/4);
   } else {
-    outb(0x1f7, IDE_CMD_READ);
+    outb(0x1f7, n * SPB > 1 ? IDE_CMD_RDMUL : IDE_CMD_READ);
   }
 }
 
+// Where b falls in the elevator's sweep: blocks at or beyond the
+// head position come first, in order, then the ones behind it.
+static uint
+idekey(struct buf *b)
+{
+  uint lba;
+
+  lba = (b->dev&1)<<28 | b->blockno;
+  return (lba < idepos) << 30 | lba;
+}
+
 // Interrupt handler.
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *next, *done;
+  int st, r;
 
-  // Take first buffer off queue.
   acquire(&idelock);
   if((b = idequeue) == 0){
     release(&idelock);
     // cprintf("spurious IDE interrupt\n");
     return;
   }
-  idequeue = b->qnext;
+
+  // Stop the DMA engine.  If the transfer failed, move
+  // the same batch again by PIO.
+  if(idedmabusy){
+    st = inb(idebm + BM_STATUS);
+    outb(idebm + BM_CMD, 0);
+    r = idewait(1);
+    outb(idebm + BM_STATUS, BM_ERR|BM_INTR);
+    if(r < 0 || (st & BM_ERR)){
+      cprintf("ide: DMA error on disk %d, using PIO\n", b->dev&1);
+      if(idemult[b->dev&1] < SPB)
+        panic("ideintr: no PIO for whole blocks");
+      idedma[b->dev&1] = 0;
+      idestart(b);
+      release(&idelock);
+      return;
+    }
+  }
+
+  // Take the batch off the queue.
+  idequeue = idelast->qnext;
+  if(idequeue == 0)
+    idetail = 0;
+  idelast->qnext = 0;
 
   // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, 512/4);
-  
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
-  
+  if(!idedmabusy && !(b->flags & B_DIRTY) && idewait(1) >= 0)
+    for(next = b; next; next = next->qnext)
+      insl(0x1f0, next->data, BSIZE/4);
+
+  // Wake processes waiting for these bufs, and collect
+  // the asynchronous ones, which nobody waits for.
+  done = 0;
+  for(; b; b = next){
+    next = b->qnext;
+    if(b->flags & B_ASYNC){
+      b->qnext = done;
+      done = b;
+    }
+    b->flags |= B_VALID;
+    b->flags &= ~(B_DIRTY|B_ASYNC);
+    wakeup(b);
+  }
+
   // Start disk on next buf in queue.
   if(idequeue != 0)
     idestart(idequeue);
+  else
+    wakeup(&idequeue);
 
   release(&idelock);
+
+  for(; done; done = next){
+    next = done->qnext;
+    bdone(done);
+  }
 }
 
-// Sync buf with disk. 
+// Add b to the queue in elevator order, starting the disk if it is idle.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// Caller must hold idelock.
+static void
+ideappend(struct buf *b)
 {
   struct buf **pp;
 
-  if(!(b->flags & B_BUSY))
-    panic("iderw: buf not busy");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
     panic("iderw: nothing to do");
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  acquire(&idelock);
-
-  // Append b to idequeue.
   b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)
+  if(idequeue == 0){
+    idequeue = idetail = b;
+    idestart(b);
+    return;
+  }
+
+  // Most requests continue the sweep: try the tail first.
+  // Never reorder the batch at the head; the disk is working on it.
+  if(idetail == idelast || idekey(idetail) < idekey(b)){
+    idetail->qnext = b;
+    idetail = b;
+    return;
+  }
+  for(pp = &idelast->qnext; *pp && idekey(*pp) < idekey(b); pp = &(*pp)->qnext)
     ;
+  b->qnext = *pp;
   *pp = b;
-  
-  // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
-  
+  if(b->qnext == 0)
+    idetail = b;
+}
+
+// Submit b to the disk and return at once.  b must have B_ASYNC set;
+// when the request completes, ideintr passes b to bdone.
+void
+idesubmit(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("idesubmit: buf not locked");
+  if(!(b->flags & B_ASYNC))
+    panic("idesubmit: not async");
+
+  acquire(&idelock);
+  ideappend(b);
+  release(&idelock);
+}
+
+// Sync buf with disk and wait for it. 
+void
+iderw(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("iderw: buf not locked");
+  if(b->flags & B_ASYNC)
+    panic("iderw: async");
+
+  acquire(&idelock);
+  ideappend(b);
+
   // Wait for request to finish.
   // Assuming will not sleep too long: ignore proc->killed.
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
@@ -152,3 +379,13 @@ iderw(struct buf *b)
 
   release(&idelock);
 }
+
+// Wait until the disk has finished every queued request.
+void
+idedrain(void)
+{
+  acquire(&idelock);
+  while(idequeue != 0)
+    sleep(&idequeue, &idelock);
+  release(&idelock);
+}
@@ -1,20 +1,51 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
 // and pipe buffers. Allocates 4096-byte pages.
+//
+// Each CPU keeps a small magazine of free pages that it allocates
+// from and frees to under its own lock, so CPUs do not serialize on
+// the global free list.  Magazines refill from and spill to the
+// global list KMAGBATCH pages at a time.
+//
+// Pages shared copy-on-write between processes carry a reference
+// count; kfree() only frees a page when its last reference goes.
+//
+// Freed pages are not cleared.  Instead each CPU keeps a pool of
+// pages it zeroed while idle (kzfill), which kzalloc() hands out to
+// callers that need a zeroed page.  Building with KALLOC_DEBUG
+// instead fills every freed page with junk to catch dangling refs.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 
+#define KMAGBATCH 16              // pages moved to/from the global list at once
+#define KMAGSIZE  (2*KMAGBATCH)   // most pages a magazine holds
+#define KZPOOL    32              // zeroed pages kept per cpu
+
 struct run {
   struct run *next;
 };
 
+// A CPU's cache of free pages.
+struct kmag {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+  struct run *zlist;  // zeroed pages, but for the link word
+  int nz;
+};
+
 struct {
   struct spinlock lock;
   struct run *freelist;
+  struct kmag mag[NCPU];
+
+  struct spinlock reflock;
+  ushort ref[PHYSTOP/PGSIZE];  // references to each allocated page
 } kmem;
 
 extern char end[]; // first address after kernel loaded from ELF file
@@ -24,33 +55,118 @@ void
 kinit(void)
 {
   char *p;
+  int i;
 
   initlock(&kmem.lock, "kmem");
+  initlock(&kmem.reflock, "kref");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.mag[i].lock, "kmag");
   p = (char*)PGROUNDUP((uint)end);
   for(; p + PGSIZE <= (char*)PHYSTOP; p += PGSIZE)
     kfree(p);
 }
 
+// Move up to n pages from the list at *from to the list at *to.
+// Returns the number moved.
+static int
+kmove(struct run **from, struct run **to, int n)
+{
+  struct run *r;
+  int i;
+
+  for(i = 0; i < n && (r = *from) != 0; i++){
+    *from = r->next;
+    r->next = *to;
+    *to = r;
+  }
+  return i;
+}
+
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// initializing the allocator; see kinit above,
+// which therefore no longer touches all of memory.)
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kmag *m;
 
   if((uint)v % PGSIZE || v < end || (uint)v >= PHYSTOP) 
     panic("kfree");
 
+  // Only the last reference frees a shared page.  An unshared
+  // page cannot become shared while its only user is freeing it,
+  // so the lock is needed only when the count says it is shared.
+  if(kmem.ref[(uint)v/PGSIZE] > 1){
+    acquire(&kmem.reflock);
+    if(kmem.ref[(uint)v/PGSIZE] > 1){
+      kmem.ref[(uint)v/PGSIZE]--;
+      release(&kmem.reflock);
+      return;
+    }
+    release(&kmem.reflock);
+  }
+  kmem.ref[(uint)v/PGSIZE] = 0;
+
+#ifdef KALLOC_DEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  acquire(&kmem.lock);
+  pushcli();  // stay on this cpu
+  m = &kmem.mag[cpu->id];
+  acquire(&m->lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  r->next = m->freelist;
+  m->freelist = r;
+  if(++m->n > KMAGSIZE){
+    acquire(&kmem.lock);
+    m->n -= kmove(&m->freelist, &kmem.freelist, KMAGBATCH);
+    release(&kmem.lock);
+  }
+  release(&m->lock);
+  popcli();
+}
+
+// Take a page off a free list: this cpu's magazine, the global
+// list, or another cpu's magazine.  Zeroed pools are left alone.
+// Returns 0 if every free list is empty.
+static struct run*
+ktake(void)
+{
+  struct run *r;
+  struct kmag *m;
+  int i;
+
+  pushcli();  // stay on this cpu
+  m = &kmem.mag[cpu->id];
+  acquire(&m->lock);
+  if(m->n == 0){
+    acquire(&kmem.lock);
+    m->n += kmove(&kmem.freelist, &m->freelist, KMAGBATCH);
+    release(&kmem.lock);
+  }
+  r = m->freelist;
+  if(r){
+    m->freelist = r->next;
+    m->n--;
+  }
+  release(&m->lock);
+
+  // Global list is dry too: take a page from another cpu's magazine.
+  for(i = 0; r == 0 && i < NCPU; i++){
+    m = &kmem.mag[i];
+    acquire(&m->lock);
+    if((r = m->freelist) != 0){
+      m->freelist = r->next;
+      m->n--;
+    }
+    release(&m->lock);
+  }
+  popcli();
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -60,12 +176,118 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kmag *m;
+  int i;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
+  // Every free list is dry: fall back on a zeroed pool.
+  for(r = ktake(), i = 0; r == 0 && i < NCPU; i++){
+    m = &kmem.mag[i];
+    acquire(&m->lock);
+    if((r = m->zlist) != 0){
+      m->zlist = r->next;
+      m->nz--;
+    }
+    release(&m->lock);
+  }
   if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+    kmem.ref[(uint)r/PGSIZE] = 1;
   return (char*)r;
 }
 
+// Return the number of free pages.
+int
+kfreepages(void)
+{
+  struct run *r;
+  struct kmag *m;
+  int n;
+
+  acquire(&kmem.lock);
+  n = 0;
+  for(r = kmem.freelist; r; r = r->next)
+    n++;
+  release(&kmem.lock);
+  for(m = kmem.mag; m < &kmem.mag[NCPU]; m++){
+    acquire(&m->lock);
+    n += m->n + m->nz;
+    release(&m->lock);
+  }
+  return n;
+}
+
+// Allocate one zeroed 4096-byte page of physical memory.
+// Returns 0 if the memory cannot be allocated.
+char*
+kzalloc(void)
+{
+  char *v;
+#ifndef KALLOC_DEBUG
+  struct run *r;
+  struct kmag *m;
+
+  pushcli();
+  m = &kmem.mag[cpu->id];
+  acquire(&m->lock);
+  if((r = m->zlist) != 0){
+    m->zlist = r->next;
+    m->nz--;
+  }
+  release(&m->lock);
+  popcli();
+  if(r){
+    r->next = 0;
+    kmem.ref[(uint)r/PGSIZE] = 1;
+    return (char*)r;
+  }
+#endif
+  if((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Zero one free page into this cpu's pool for kzalloc().
+// Called by the scheduler when it has nothing to run.
+// Returns 1 if it did any work, 0 if the pool is full or no
+// page is free.  Pages come only from the free lists: taking
+// one back from a zeroed pool would be work that never ends.
+int
+kzfill(void)
+{
+#ifdef KALLOC_DEBUG
+  return 0;
+#else
+  struct run *r;
+  struct kmag *m;
+
+  pushcli();
+  m = &kmem.mag[cpu->id];
+  popcli();
+  if(m->nz >= KZPOOL || (r = ktake()) == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+
+  acquire(&m->lock);
+  r->next = m->zlist;
+  m->zlist = r;
+  m->nz++;
+  release(&m->lock);
+  return 1;
+#endif
+}
+
+// Add a reference to the allocated page v, which
+// will now take one more kfree() to free.
+void
+kref(char *v)
+{
+  acquire(&kmem.reflock);
+  kmem.ref[(uint)v/PGSIZE]++;
+  release(&kmem.reflock);
+}
+
+// Return the number of references to the allocated page v.
+int
+krefcount(char *v)
+{
+  return kmem.ref[(uint)v/PGSIZE];
+}
@@ -0,0 +1,309 @@
+// Write-ahead log, so that a crash cannot leave the file
+// system half-changed.
+//
+// A system call that changes the file system brackets its changes
+// with begin_op() and end_op(), and writes each block it changes
+// with log_write() instead of bwrite().  The changes of all the
+// calls in progress at once make up one transaction: when the last
+// of them ends, commit() copies the changed blocks into the log on
+// disk, writes the log header, which is the commit point, then
+// writes the blocks to their home locations and clears the header.
+// Calls that arrive during a commit, or that might not fit in what
+// is left of the log, wait for it.
+//
+// Until a block has been written home it is pinned in the buffer
+// cache, so that neither bsync nor a buffer miss writes it out
+// before its transaction commits.
+//
+// The first begin_op reads the superblock of ROOTDEV and, if the
+// header says a transaction committed before a crash, writes its
+// blocks home again.  A file system whose superblock has no log
+// (nlog == 0) is changed in place, as before: begin_op and end_op
+// then do nothing and log_write is bwrite.
+//
+// The on-disk log is a header block, then the logged blocks:
+//   [ header | block A | block B | ... ]
+// starting at sb.logstart.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+
+// Contents of the header block: which home blocks the logged
+// blocks belong to.  n is 0 unless a transaction has committed.
+struct logheader {
+  int n;
+  int block[LOGSIZE];
+};
+
+struct log {
+  struct spinlock lock;
+  struct sleeplock setup;  // held while the log is read on first use
+  int ready;
+  int dev;
+  int start;
+  int size;         // capacity in blocks; 0 if there is no log
+  int outstanding;  // how many FS sys calls are executing
+  int committing;   // in commit(), please wait
+  struct logheader lh;
+};
+struct log log;
+
+static void recover_from_log(void);
+static void commit(void);
+
+void
+initlog(void)
+{
+  if(sizeof(struct logheader) >= BSIZE)
+    panic("initlog: too big logheader");
+  initlock(&log.lock, "log");
+  initsleeplock(&log.setup, "logsetup");
+}
+
+// Find the log on first use, and recover from it.
+// Needs a process, to read the superblock.  The superblock is
+// read straight from disk: the mount entry (see getmount in fs.c)
+// summarizes the bitmap and inodes, so it must not be built
+// until recovery has put them back.
+static void
+logsetup(void)
+{
+  struct superblock sb;
+
+  acquiresleep(&log.setup);
+  if(!log.ready){
+    readsb(ROOTDEV, &sb);
+    if((sb.bsize ? sb.bsize : 512) != BSIZE)
+      panic("logsetup: block size");
+    log.dev = ROOTDEV;
+    log.start = sb.logstart;
+    log.size = sb.nlog > 0 ? sb.nlog - 1 : 0;
+    if(log.size > LOGSIZE)
+      log.size = LOGSIZE;
+    if(log.size > 0 && log.size < MAXOPBLOCKS)
+      panic("logsetup: log too small");
+    if(log.size > 0)
+      recover_from_log();
+    __sync_synchronize();  // set up log before marking it ready
+    log.ready = 1;
+  }
+  releasesleep(&log.setup);
+}
+
+// Wait for the write of pinned block blockno, started with
+// bstart, and unpin it.  Waiting for the buffer itself, rather
+// than for the whole disk queue (idedrain), keeps a commit from
+// waiting behind other processes' reads.
+static void
+log_wait(uint blockno)
+{
+  struct buf *b;
+
+  b = bread(log.dev, blockno);  // sleeps until the write is done
+  bunpin(b);
+  brelse(b);
+}
+
+// Copy the blocks of the transaction to their home locations
+// and wait for the disk.  The blocks come from the log on disk
+// when recovering, else from the (pinned) buffer cache.
+static void
+install_trans(int recovering)
+{
+  int tail;
+  struct buf *lbuf, *dbuf;
+
+  for(tail = 0; tail < log.lh.n; tail++){
+    if(recovering){
+      dbuf = bnew(log.dev, log.lh.block[tail]);
+      lbuf = bread(log.dev, log.start+tail+1);
+      memmove(dbuf->data, lbuf->data, BSIZE);
+      brelse(lbuf);
+      bpin(dbuf);
+    } else
+      dbuf = bread(log.dev, log.lh.block[tail]);  // already pinned
+    bstart(dbuf);
+  }
+  for(tail = 0; tail < log.lh.n; tail++)
+    log_wait(log.lh.block[tail]);
+}
+
+// Read the log header from disk into the in-memory log header.
+static void
+read_head(void)
+{
+  struct buf *buf;
+  struct logheader *lh;
+  int i;
+
+  buf = bread(log.dev, log.start);
+  lh = (struct logheader*)buf->data;
+  log.lh.n = lh->n;
+  if(log.lh.n < 0 || log.lh.n > log.size)
+    panic("read_head: bad log header");
+  for(i = 0; i < log.lh.n; i++)
+    log.lh.block[i] = lh->block[i];
+  brelse(buf);
+}
+
+// Write the in-memory log header to disk and wait for it.
+// This is the true point at which the current transaction commits.
+static void
+write_head(void)
+{
+  struct buf *buf;
+  struct logheader *hb;
+  int i;
+
+  buf = bnew(log.dev, log.start);
+  memset(buf->data, 0, BSIZE);
+  hb = (struct logheader*)buf->data;
+  hb->n = log.lh.n;
+  for(i = 0; i < log.lh.n; i++)
+    hb->block[i] = log.lh.block[i];
+  bpin(buf);
+  bstart(buf);
+  log_wait(log.start);
+}
+
+static void
+recover_from_log(void)
+{
+  read_head();
+  if(log.lh.n > 0)
+    cprintf("log: recovering %d blocks\n", log.lh.n);
+  install_trans(1);  // if committed, copy from log to disk
+  log.lh.n = 0;
+  write_head();  // clear the log
+}
+
+// Called at the start of each FS system call.
+void
+begin_op(void)
+{
+  if(!log.ready)
+    logsetup();
+  acquire(&log.lock);
+  for(;;){
+    if(log.committing){
+      sleep(&log, &log.lock);
+    } else if(log.size > 0 &&
+              log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.size){
+      // this op might exhaust log space; wait for commit.
+      sleep(&log, &log.lock);
+    } else {
+      log.outstanding += 1;
+      release(&log.lock);
+      break;
+    }
+  }
+}
+
+// Called at the end of each FS system call.
+// Commits if this was the last outstanding operation.
+void
+end_op(void)
+{
+  int do_commit = 0;
+
+  acquire(&log.lock);
+  log.outstanding -= 1;
+  if(log.committing)
+    panic("log.committing");
+  if(log.outstanding == 0){
+    do_commit = 1;
+    log.committing = 1;
+  } else {
+    // begin_op() may be waiting for log space,
+    // and decrementing log.outstanding has decreased
+    // the amount of reserved space.
+    wakeup(&log);
+  }
+  release(&log.lock);
+
+  if(do_commit){
+    // call commit w/o holding locks, since not allowed
+    // to sleep with locks.
+    commit();
+    acquire(&log.lock);
+    log.committing = 0;
+    wakeup(&log);
+    release(&log.lock);
+  }
+}
+
+// Copy the modified blocks from the cache to the log on disk,
+// all at once, so the disk can take them in one sweep.
+static void
+write_log(void)
+{
+  int tail;
+  struct buf *to, *from;
+
+  for(tail = 0; tail < log.lh.n; tail++){
+    to = bnew(log.dev, log.start+tail+1);  // log block
+    from = bread(log.dev, log.lh.block[tail]);  // cache block
+    memmove(to->data, from->data, BSIZE);
+    brelse(from);
+    bpin(to);
+    bstart(to);
+  }
+  for(tail = 0; tail < log.lh.n; tail++)
+    log_wait(log.start+tail+1);
+}
+
+static void
+commit(void)
+{
+  if(log.lh.n > 0){
+    write_log();      // Write modified blocks from cache to log
+    write_head();     // Write header to disk -- the real commit
+    install_trans(0); // Now install writes to home locations
+    log.lh.n = 0;
+    write_head();     // Erase the transaction from the log
+  }
+}
+
+// Caller has modified b->data and is done with the buffer.
+// Record the block number and pin it in the cache until the
+// transaction commits.  commit()/write_log() will do the disk
+// write.  A block written again before the commit takes up one
+// place in the log (absorption).
+//
+// log_write() replaces bwrite(); a typical use is:
+//   bp = bread(...)
+//   modify bp->data[]
+//   log_write(bp)
+//   brelse(bp)
+void
+log_write(struct buf *b)
+{
+  int i;
+
+  if(log.size == 0 || b->dev != log.dev){
+    bwrite(b);
+    return;
+  }
+  if(log.outstanding < 1)
+    panic("log_write outside of trans");
+
+  acquire(&log.lock);
+  for(i = 0; i < log.lh.n; i++){
+    if(log.lh.block[i] == b->blockno)   // log absorption
+      break;
+  }
+  if(i == log.lh.n){
+    if(log.lh.n >= log.size)
+      panic("too big a transaction");
+    log.lh.block[i] = b->blockno;
+    log.lh.n++;
+    bpin(b);
+  }
+  release(&log.lock);
+  bwrite(b);  // B_DIRTY, though only commit writes it
+}
@@ -53,6 +53,7 @@ mainc(void)
   binit();         // buffer cache
   fileinit();      // file table
   iinit();         // inode cache
+  initlog();       // file system log
   ideinit();       // disk
   if(!ismp)
     timerinit();   // uniprocessor timer
@@ -62,6 +63,7 @@ mainc(void)
   cinit();
   sti();           // enable inturrupts
   userinit();      // first user process
+  kthread("bflush", bflush);  // buffer cache write-back
   scheduler();     // start running processes
 }
 
@@ -13,6 +13,7 @@ KERNEL_OBJECTS := \
 	lapic.o\
 	main.o\
 	mp.o\
+	pci.o\
 	picirq.o\
 	pipe.o\
 	proc.o\
@@ -25,10 +26,13 @@ KERNEL_OBJECTS := \
 	timer.o\
 	trapasm.o\
 	trap.o\
+	twheel.o\
 	uart.o\
 	vectors.o\
 	vm.o\
-	rand.o
+	rand.o\
+	sleeplock.o\
+	log.o
 
 KERNEL_OBJECTS := $(addprefix kernel/, $(KERNEL_OBJECTS))
 
@@ -78,6 +82,14 @@ KERNEL_CFLAGS += -fno-strict-aliasing
 KERNEL_CFLAGS += -fno-stack-protector
 # generate code for 32-bit environment
 KERNEL_CFLAGS += -m32
+# select the scheduling policy (see SCHEDPOLICY in Makefile)
+ifeq ($(SCHEDPOLICY),stride)
+KERNEL_CFLAGS += -DSTRIDE_SCHEDULER
+endif
+# poison freed pages (see KALLOC_DEBUG in Makefile)
+ifeq ($(KALLOC_DEBUG),1)
+KERNEL_CFLAGS += -DKALLOC_DEBUG
+endif
 
 KERNEL_ASFLAGS += $(KERNEL_CFLAGS)
 
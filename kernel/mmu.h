@@ -135,9 +135,16 @@ struct segdesc {
 #define PTE_D		0x040	// Dirty
 #define PTE_PS		0x080	// Page Size
 #define PTE_MBZ		0x180	// Bits must be zero
+#define PTE_COW		0x200	// Copy-on-write (software-defined bit)
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)	((uint)(pte) & ~0xFFF)
+#define PTE_FLAGS(pte)	((uint)(pte) &  0xFFF)
+
+// Page fault error code bits (trapframe err)
+#define FEC_PR		0x1	// Page fault caused by protection violation
+#define FEC_WR		0x2	// Page fault caused by a write
+#define FEC_U		0x4	// Page fault occured while in user mode
 
 typedef uint pte_t;
 
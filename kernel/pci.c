@@ -0,0 +1,46 @@
+// PCI configuration space, through configuration mechanism #1.
+// Only bus 0 is searched, which is where QEMU puts its devices.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+
+#define PCI_CONFADDR  0xcf8
+#define PCI_CONFDATA  0xcfc
+
+#define PCI_ID        0x00  // vendor (low 16 bits) and device id
+#define PCI_CLASS     0x08  // class, subclass, prog-if, revision
+
+// Read the 32-bit register at offset off in the configuration
+// space of the function with the given tag (see pcifind).
+uint
+pciread(int tag, int off)
+{
+  outl(PCI_CONFADDR, 0x80000000 | tag << 8 | (off & 0xfc));
+  return inl(PCI_CONFDATA);
+}
+
+void
+pciwrite(int tag, int off, uint v)
+{
+  outl(PCI_CONFADDR, 0x80000000 | tag << 8 | (off & 0xfc));
+  outl(PCI_CONFDATA, v);
+}
+
+// Find the first function on bus 0 of the given class and subclass.
+// Returns its tag (device << 3 | function), or -1 if there is none.
+int
+pcifind(int class, int subclass)
+{
+  int tag;
+  uint c;
+
+  for(tag = 0; tag < 32*8; tag++){
+    if((pciread(tag, PCI_ID) & 0xffff) == 0xffff)
+      continue;
+    c = pciread(tag, PCI_CLASS);
+    if((c >> 24) == class && ((c >> 16) & 0xff) == subclass)
+      return tag;
+  }
+  return -1;
+}
@@ -5,12 +5,22 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "traps.h"
 #include "rand.h"
 #include "pstat.h"
+#include "cpustat.h"
+
+// Sleeping processes are kept in a hash table of wait queues keyed
+// by the channel they sleep on, so a wakeup only looks at processes
+// that hashed to the same bucket.
+#define SLEEPQBITS 6
+#define NSLEEPQ (1 << SLEEPQBITS)
+#define SLEEPQ(chan) (((uint)(chan) * 2654435761U) >> (32 - SLEEPQBITS))
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct proc *sleepq[NSLEEPQ]; // SLEEPING procs, linked through qnext
 } ptable;
 
 static struct proc *initproc;
@@ -21,7 +31,201 @@ extern void trapret(void);
 
 static void wakeup1(void *chan);
 
-void pinit(void) { initlock(&ptable.lock, "ptable"); }
+void pinit(void) {
+  struct cpu *c;
+
+  initlock(&ptable.lock, "ptable");
+  for (c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->rq.lock, "runq");
+}
+
+// Scheduling policy, chosen at build time (see SCHEDPOLICY in the
+// Makefile).  Both policies take their weights from settickets().
+#ifdef STRIDE_SCHEDULER
+static const int schedpolicy = SCHED_STRIDE;
+#else
+static const int schedpolicy = SCHED_LOTTERY;
+#endif
+
+// Stride of a process holding one ticket.  Strides and passes are
+// compared with wraparound, which is safe because the passes queued
+// on one CPU never spread further apart than STRIDE1.
+#define STRIDE1 (1 << 20)
+#define PASSLT(a, b) ((int)((a) - (b)) < 0)
+
+// Run queues.
+//
+// Each CPU chooses among the processes on its own run queue, under
+// that queue's lock, so choosing what to run next does not touch
+// ptable.lock.  A process joins a queue when it becomes RUNNABLE
+// (under ptable.lock, see setrunnable) and leaves it when a CPU picks
+// it.  A CPU with an empty queue steals from the peer with the most
+// queued tickets.  Lock order: ptable.lock, then one rq lock; never
+// two rq locks at once.
+
+// Add delta tickets to ptable slot i of rq's lottery.
+static void fenwickadd(struct runq *rq, int i, uint delta) {
+  for (i++; i <= NPROC; i += i & -i)
+    rq->fenwick[i] += delta;
+}
+
+// Restore the heap order of rq->heap after slot i changed,
+// moving it up if it is below its parent, else down.
+static void heapfix(struct runq *rq, int i) {
+  struct proc *p;
+  int c;
+
+  p = rq->heap[i];
+  while (i > 0 && PASSLT(p->pass, rq->heap[(i - 1) / 2]->pass)) {
+    rq->heap[i] = rq->heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  for (;;) {
+    c = 2 * i + 1;
+    if (c >= rq->nheap)
+      break;
+    if (c + 1 < rq->nheap && PASSLT(rq->heap[c + 1]->pass, rq->heap[c]->pass))
+      c++;
+    if (!PASSLT(rq->heap[c]->pass, p->pass))
+      break;
+    rq->heap[i] = rq->heap[c];
+    i = c;
+  }
+  rq->heap[i] = p;
+}
+
+// Queue p on rq.  The rq lock must be held.
+static void rqpush(struct runq *rq, struct proc *p) {
+  int i;
+
+  i = p - ptable.proc;
+  rq->tickets[i] = p->numTickets;
+  rq->total += p->numTickets;
+  if (schedpolicy == SCHED_STRIDE) {
+    // Forfeit credit built up while sleeping or queued elsewhere,
+    // and don't fall more than one stride behind those already here.
+    if (PASSLT(p->pass, rq->pass))
+      p->pass = rq->pass;
+    if (PASSLT(rq->pass + p->stride, p->pass))
+      p->pass = rq->pass + p->stride;
+    rq->heap[rq->nheap++] = p;
+    heapfix(rq, rq->nheap - 1);
+  } else {
+    fenwickadd(rq, i, p->numTickets);
+  }
+}
+
+// Take the next process to run off rq and return it: the lottery
+// winner, or the process with the smallest pass.
+// The rq lock must be held and rq->total must be non-zero.
+static struct proc *rqpop(struct runq *rq) {
+  struct proc *p;
+  int pos, step;
+  uint n;
+
+  if (schedpolicy == SCHED_STRIDE) {
+    p = rq->heap[0];
+    rq->heap[0] = rq->heap[--rq->nheap];
+    if (rq->nheap > 0)
+      heapfix(rq, 0);
+    rq->pass = p->pass;
+    p->pass += p->stride; // charge for the quantum it is about to run
+    pos = p - ptable.proc;
+  } else {
+    // Find the first slot whose running ticket sum reaches n.
+    n = (rand() % rq->total) + 1;
+    for (step = 1; step * 2 <= NPROC; step <<= 1)
+      ;
+    for (pos = 0; step > 0; step >>= 1) {
+      if (pos + step <= NPROC && rq->fenwick[pos + step] < n) {
+        pos += step;
+        n -= rq->fenwick[pos];
+      }
+    }
+    fenwickadd(rq, pos, -rq->tickets[pos]);
+    p = &ptable.proc[pos];
+  }
+  rq->total -= rq->tickets[pos];
+  rq->tickets[pos] = 0;
+  return p;
+}
+
+// Pick the next process for this CPU and take it off its run queue:
+// this CPU's choice or, if its queue is empty, the busiest peer's.
+// Returns 0 if nothing is runnable anywhere.
+static struct proc *rqpick(void) {
+  struct cpu *c, *victim;
+  struct proc *p;
+
+  p = 0;
+  acquire(&cpu->rq.lock);
+  if (cpu->rq.total > 0)
+    p = rqpop(&cpu->rq);
+  release(&cpu->rq.lock);
+  if (p)
+    return p;
+
+  victim = 0;
+  for (c = cpus; c < &cpus[ncpu]; c++)
+    if (c != cpu && c->rq.total > 0 &&
+        (victim == 0 || c->rq.total > victim->rq.total))
+      victim = c;
+  if (victim == 0)
+    return 0;
+
+  acquire(&victim->rq.lock);
+  if (victim->rq.total > 0) // may have drained since we looked
+    p = rqpop(&victim->rq);
+  release(&victim->rq.lock);
+  return p;
+}
+
+// Mark p RUNNABLE and queue it: on the CPU it last ran on if that
+// one is idle, else on any idle CPU, else on the CPU with the fewest
+// queued tickets, staying where it last ran unless that is more than
+// p's own tickets worse.  Keeping the ticket totals level keeps each
+// CPU's lottery fair with respect to the whole system.  A halted
+// CPU is sent an IPI so that it notices the new arrival.
+// The ptable lock must be held.
+static void setrunnable(struct proc *p) {
+  struct cpu *c, *best;
+
+  best = &cpus[p->lastcpu];
+  for (c = cpus; c < &cpus[ncpu] && !best->idle; c++)
+    if (c->idle || c->rq.total + p->numTickets < best->rq.total)
+      best = c;
+
+  acquire(&best->rq.lock);
+  p->state = RUNNABLE;
+  rqpush(&best->rq, p);
+  release(&best->rq.lock);
+
+  // An idle cpu taking the interrupt that got us here will look
+  // at the queues on its own once the handler returns.
+  if (best->idle && best != cpu)
+    lapicipi(best->id, T_IRQ0 + IRQ_WAKEUP);
+}
+
+// Nothing to run: halt until the next interrupt instead of spinning.
+// Announce ourselves idle before the final look at the run queues:
+// a process queued after that look makes setrunnable send us an IPI.
+// Until then, use the spare time to zero free pages for kzalloc,
+// one page per call so that new work is noticed promptly.
+static void idle(void) {
+  struct cpu *c;
+
+  if (kzfill())
+    return;
+
+  cli();
+  xchg(&cpu->idle, 1);
+  for (c = cpus; c < &cpus[ncpu]; c++)
+    if (c->rq.total > 0)
+      break;
+  if (c == &cpus[ncpu])
+    stihlt();
+  xchg(&cpu->idle, 0);
+}
 
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
@@ -43,7 +247,11 @@ found:
   p->pid = nextpid++;
 
   p->numTickets = 1; 		//initialize tickets
+  p->stride = STRIDE1;
+  p->pass = 0;
   p->numTicks = 0; 		//initialize ticks (times process has been scheduled)
+  p->pgfaults = 0;
+  p->lastcpu = cpu->id;
 
   release(&ptable.lock);
 
@@ -95,19 +303,44 @@ void userinit(void) {
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
+  release(&ptable.lock);
+}
+
+// Start a kernel thread running fn, which must never return.
+// It has no user memory, only the kernel part of a page table.
+void kthread(char *name, void (*fn)(void)) {
+  struct proc *p;
+
+  if ((p = allocproc()) == 0)
+    panic("kthread");
+  if ((p->pgdir = setupkvm()) == 0)
+    panic("kthread: out of memory?");
+  p->sz = 0;
+  p->parent = 0;
+  p->cwd = 0;
+
+  // forkret returns into fn rather than trapret (see allocproc).
+  *(uint *)(p->context + 1) = (uint)fn;
+
+  safestrcpy(p->name, name, sizeof(p->name));
+  acquire(&ptable.lock);
+  setrunnable(p);
   release(&ptable.lock);
 }
 
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
+// Growing only reserves the address range; the pages
+// are allocated when first touched (see lazyalloc).
 int growproc(int n) {
   uint sz;
 
   sz = proc->sz;
   if (n > 0) {
-    if ((sz = allocuvm(proc->pgdir, sz, sz + n)) == 0)
+    if (sz + n > USERTOP || sz + n < sz)
       return -1;
+    sz += n;
   } else if (n < 0) {
     if ((sz = deallocuvm(proc->pgdir, sz, sz + n)) == 0)
       return -1;
@@ -149,10 +382,14 @@ int fork(void) {
 
   np->numTickets =
       proc->numTickets; // new process tickets  = parent process tickets
+  np->stride = proc->stride;
+  np->pass = proc->pass;
 
   pid = np->pid;
-  np->state = RUNNABLE;
   safestrcpy(np->name, proc->name, sizeof(proc->name));
+  acquire(&ptable.lock);
+  setrunnable(np);
+  release(&ptable.lock);
   return pid;
 }
 
@@ -174,7 +411,9 @@ void exit(void) {
     }
   }
 
+  begin_op();
   iput(proc->cwd);
+  end_op();
   proc->cwd = 0;
 
   acquire(&ptable.lock);
@@ -241,53 +480,43 @@ int wait(void) {
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run
+//  - draw a process from this CPU's run queue (or steal one)
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
 void scheduler(void) {
   struct proc *p;
-  
+
   for (;;) {
-	// Enable interrupts on this processor.
-	//what is "sti()"?
-	sti();
-	
-	uint ticketCounter = 0; 				// the count of all tickets held by all processes
-	acquire(&ptable.lock); 				//lock table
-	for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) 	//for-each process in process-table, summate tickets
-		if (p->state == RUNNABLE){ 			//if the process can be run
-			ticketCounter = ticketCounter + p->numTickets; 	//add the processes tickets to the ticketCounter
-		}
-	release(&ptable.lock); 				//unlock table
-	if (ticketCounter == 0) continue; 		//if we cannot do a lottery, skip.
-	uint lotteryWinner = (rand() % ticketCounter) + 1; 	//The number of tickets that must be exceeded to choose the winner
-
-	acquire(&ptable.lock); 					//lock table
-	ticketCounter = 0; // reset the count
-	for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) { 	// Loop over process table looking for process to run.
-		if (p->state != RUNNABLE) 			// if the process is not runnable, skip to next process
-			continue;
-		ticketCounter += p->numTickets; 		//increment the ticket counter
-		if (ticketCounter < lotteryWinner) continue;	//if this isn't a winner, skip to the next process
-//		cprintf("!%d,%d|\n",ticketCounter, lotteryWinner);
-
-		// Switch to chosen process.  It is the process's job
-		// to release ptable.lock and then reacquire it
-		// before jumping back to us.
-		proc = p;
-		switchuvm(p);
-		p->state = RUNNING;
-		p->numTicks++;
-		swtch(&cpu->scheduler, proc->context);
-		switchkvm();
-		
-		// Process is done running for now.
-		// It should have changed its p->state before coming back.
-		proc = 0;
-		break;
-	}
-	release(&ptable.lock); 					//unlock table
+    // Enable interrupts on this processor.
+    sti();
+
+    // The winner is off every run queue, so it stays RUNNABLE
+    // and nobody else will pick it while we wait for ptable.lock.
+    if ((p = rqpick()) == 0) {
+      idle();
+      continue;
+    }
+
+    acquire(&ptable.lock);
+    if (p->state != RUNNABLE)
+      panic("scheduler: winner not runnable");
+
+    // Switch to chosen process.  It is the process's job
+    // to release ptable.lock and then reacquire it
+    // before jumping back to us.
+    proc = p;
+    switchuvm(p);
+    p->state = RUNNING;
+    p->numTicks++;
+    p->lastcpu = cpu->id;
+    swtch(&cpu->scheduler, proc->context);
+    switchkvm();
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    proc = 0;
+    release(&ptable.lock);
   }
 }
 
@@ -298,6 +527,9 @@ int settickets(uint numTickets) {
     return -1;
   // updated process tickets
   proc->numTickets = numTickets;
+  proc->stride = STRIDE1 / numTickets;
+  if (proc->stride == 0)
+    proc->stride = 1;
   // return successful
   return 0;
 }
@@ -306,6 +538,7 @@ int settickets(uint numTickets) {
  * return 0 on success and -1 on FAILURE*/
 int getpinfo(struct pstat *referenced_table){
 	if (referenced_table == NULL) return -1; //if the pointer is NULL, return FAILURE
+	referenced_table->policy = schedpolicy; //which scheduler is choosing processes
 
 	struct proc *process; 	//points to a process structure
 	int index = 0; 		//current index in pstat referenced_table
@@ -319,6 +552,8 @@ int getpinfo(struct pstat *referenced_table){
 		referenced_table->pid[index] = process->pid;
 		referenced_table->tickets[index] = process->numTickets;
 		referenced_table->ticks[index] = process->numTicks;
+		referenced_table->faults[index] = process->pgfaults;
+		referenced_table->resident[index] = (process->state != UNUSED && process->pgdir) ? uvmresident(process->pgdir, process->sz) : 0;
 		//increment counter
 		index++;
 	} release(&ptable.lock); 	//released the lock so that the table can be used
@@ -326,6 +561,18 @@ int getpinfo(struct pstat *referenced_table){
 
 	return 0; //if function has reached end of execution, return SUCCESS
 }
+// Fill in the per-cpu idle statistics.
+int getcpuinfo(struct cpustat *st) {
+  int i;
+
+  st->ncpu = ncpu;
+  for (i = 0; i < ncpu; i++) {
+    st->ticks[i] = cpus[i].ticks;
+    st->idleticks[i] = cpus[i].idleticks;
+  }
+  return 0;
+}
+
 // Enter scheduler.  Must hold only ptable.lock
 // and have changed proc->state.
 void sched(void) {
@@ -347,7 +594,7 @@ void sched(void) {
 // Give up the CPU for one scheduling round.
 void yield(void) {
   acquire(&ptable.lock); // DOC: yieldlock
-  proc->state = RUNNABLE;
+  setrunnable(proc);
   sched();
   release(&ptable.lock);
 }
@@ -384,9 +631,11 @@ void sleep(void *chan, struct spinlock *lk) {
   // Go to sleep.
   proc->chan = chan;
   proc->state = SLEEPING;
+  proc->qnext = ptable.sleepq[SLEEPQ(chan)];
+  ptable.sleepq[SLEEPQ(chan)] = proc;
   sched();
 
-  // Tidy up.
+  // Tidy up.  Whoever woke us took us off the wait queue.
   proc->chan = 0;
 
   // Reacquire original lock.
@@ -399,11 +648,17 @@ void sleep(void *chan, struct spinlock *lk) {
 // Wake up all processes sleeping on chan.
 // The ptable lock must be held.
 static void wakeup1(void *chan) {
-  struct proc *p;
-
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if (p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  struct proc *p, **pp;
+
+  pp = &ptable.sleepq[SLEEPQ(chan)];
+  while ((p = *pp) != 0) {
+    if (p->chan == chan) {
+      *pp = p->qnext;
+      setrunnable(p);
+    } else {
+      pp = &p->qnext;
+    }
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -417,15 +672,19 @@ void wakeup(void *chan) {
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
 int kill(int pid) {
-  struct proc *p;
+  struct proc *p, **pp;
 
   acquire(&ptable.lock);
   for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
     if (p->pid == pid) {
       p->killed = 1;
       // Wake process from sleep if necessary.
-      if (p->state == SLEEPING)
-        p->state = RUNNABLE;
+      if (p->state == SLEEPING) {
+        for (pp = &ptable.sleepq[SLEEPQ(p->chan)]; *pp != p; pp = &(*pp)->qnext)
+          ;
+        *pp = p->qnext;
+        setrunnable(p);
+      }
       release(&ptable.lock);
       return 0;
     }
@@ -10,6 +10,24 @@
 #define SEG_TSS   6  // this process's task state
 #define NSEGS     7
 
+#include "spinlock.h"
+
+// Per-CPU run queue: the RUNNABLE processes this CPU chooses among.
+// Under the lottery policy tickets are kept in a Fenwick (binary
+// indexed) tree over ptable slots so a draw is O(log NPROC); fenwick[]
+// is 1-based.  Under the stride policy the processes sit in a binary
+// min-heap ordered by pass.  Either way tickets[i] is what slot i
+// contributes and total is their sum.
+struct runq {
+  struct spinlock lock;
+  uint fenwick[NPROC+1];       // Lottery: ticket prefix sums
+  struct proc *heap[NPROC];    // Stride: min-heap on proc->pass
+  int nheap;
+  uint pass;                   // Stride: pass of the last process chosen
+  uint tickets[NPROC];
+  volatile uint total;
+};
+
 // Per-CPU state
 struct cpu {
   uchar id;                    // Local APIC ID; index into cpus[] below
@@ -19,6 +37,10 @@ struct cpu {
   volatile uint booted;        // Has the CPU started?
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
+  struct runq rq;              // Processes waiting to run on this cpu
+  volatile uint idle;          // Halted in idle() with nothing to run?
+  uint ticks;                  // Timer interrupts taken by this cpu
+  uint idleticks;              // ... of which arrived while idle
 
   // Cpu-local storage variables; see below
   struct cpu *cpu;
@@ -70,6 +92,7 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *qnext;          // Next sleeper in chan's wait queue
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
@@ -77,7 +100,11 @@ struct proc {
 
   uint numTickets; 		//The number of tickets the process has
   uint numTicks; 		//The number of times the process is scheduled on the cpu
- 
+  int lastcpu;                 // Index of the cpu it last ran on
+  uint stride;                 // Stride policy: STRIDE1 / numTickets
+  uint pass;                   // Stride policy: virtual time of next run
+  uint pgfaults;               // Page faults handled (lazy heap and copy-on-write)
+
 };
 
 // Process memory is laid out contiguously, low addresses first:
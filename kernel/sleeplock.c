@@ -0,0 +1,82 @@
+// Sleeping locks
+//
+// Waiters queue up on the lock in arrival order.  Releasing a lock
+// that has waiters hands it straight to the oldest one and wakes only
+// that process, so a release never sets off a crowd of wakeups that
+// all race to retake the lock and mostly go back to sleep.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+
+// A process waiting for a sleeplock, on its own kernel stack.
+struct slwaiter {
+  struct slwaiter *next;
+  int granted;              // Lock has been handed to us
+};
+
+void
+initsleeplock(struct sleeplock *lk, char *name)
+{
+  initlock(&lk->lk, "sleep lock");
+  lk->name = name;
+  lk->locked = 0;
+  lk->pid = 0;
+  lk->head = 0;
+  lk->tail = &lk->head;
+}
+
+// Acquire the lock, sleeping until it is handed to us if need be.
+void
+acquiresleep(struct sleeplock *lk)
+{
+  struct slwaiter w;
+
+  acquire(&lk->lk);
+  if(lk->locked){
+    w.next = 0;
+    w.granted = 0;
+    *lk->tail = &w;
+    lk->tail = &w.next;
+    while(!w.granted)
+      sleep(&w, &lk->lk);
+  }
+  lk->locked = 1;
+  lk->pid = proc->pid;
+  release(&lk->lk);
+}
+
+// Release the lock, passing it to the oldest waiter if there is one.
+void
+releasesleep(struct sleeplock *lk)
+{
+  struct slwaiter *w;
+
+  acquire(&lk->lk);
+  if((w = lk->head) != 0){
+    if((lk->head = w->next) == 0)
+      lk->tail = &lk->head;
+    w->granted = 1;
+    wakeup(w);
+  } else
+    lk->locked = 0;
+  lk->pid = 0;
+  release(&lk->lk);
+}
+
+// Does this process hold the lock?
+int
+holdingsleep(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = lk->locked && lk->pid == proc->pid;
+  release(&lk->lk);
+  return r;
+}
@@ -0,0 +1,18 @@
+#ifndef _SLEEPLOCK_H_
+#define _SLEEPLOCK_H_
+#include "spinlock.h"
+
+// Long-term lock for processes: a process that cannot get it
+// sleeps, queued on the lock, instead of spinning.
+struct sleeplock {
+  uint locked;              // Is the lock held?
+  struct spinlock lk;       // Protects this sleep lock
+  struct slwaiter *head;    // Queue of sleeping waiters, oldest first
+  struct slwaiter **tail;   // Link to append the next waiter at
+
+  // For debugging:
+  char *name;               // Name of lock.
+  int pid;                  // Process holding lock
+};
+
+#endif // _SLEEPLOCK_H_
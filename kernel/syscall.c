@@ -108,6 +108,10 @@ static int (*syscalls[])(void) = {
 [SYS_cluis]   sys_cluis,
 [SYS_settickets]  sys_settickets,
 [SYS_getpinfo]   sys_getpinfo,
+[SYS_getcpuinfo] sys_getcpuinfo,
+[SYS_sleep_until] sys_sleep_until,
+[SYS_sync]    sys_sync,
+[SYS_fsync]   sys_fsync,
 };
 
 // Called on a syscall trap. Checks that the syscall number (passed via eax)
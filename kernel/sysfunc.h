@@ -26,5 +26,9 @@ int sys_uptime(void);
 int sys_luic(void);
 int sys_settickets(void);
 int sys_getpinfo(void);
+int sys_getcpuinfo(void);
+int sys_sleep_until(void);
+int sys_sync(void);
+int sys_fsync(void);
 
 #endif // _SYSFUNC_H_
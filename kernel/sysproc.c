@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "sysfunc.h"
 #include "pstat.h"
+#include "cpustat.h"
 
 int counter=0;
 
@@ -34,6 +35,12 @@ int sys_getpinfo(void) {
 	getpinfo(table); 						//call getpinfo()
 	return 0; 							//return success
 }
+//fills out a cpustat structure with per-cpu idle statistics
+int sys_getcpuinfo(void) {
+	struct cpustat *st;
+	if (argptr(0, (void *)&st, sizeof(*st)) < 0) return -1;
+	return getcpuinfo(st);
+}
 
 int
 sys_exit(void)
@@ -88,22 +95,28 @@ sys_sbrk(void)
 int
 sys_sleep(void)
 {
-  int n;
-  uint ticks0;
+  int n, r;
   
   if(argint(0, &n) < 0)
     return -1;
   acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(proc->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
+  r = twsleep(ticks + n);
+  release(&tickslock);
+  return r;
+}
+
+// sleep until the clock tick counter (see uptime) reaches deadline
+int
+sys_sleep_until(void)
+{
+  int deadline, r;
+
+  if(argint(0, &deadline) < 0)
+    return -1;
+  acquire(&tickslock);
+  r = twsleep(deadline);
   release(&tickslock);
-  return 0;
+  return r;
 }
 
 // return how many clock tick interrupts have occurred
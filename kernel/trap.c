@@ -34,6 +34,8 @@ idtinit(void)
 void
 trap(struct trapframe *tf)
 {
+  int r;
+
   if(tf->trapno == T_SYSCALL){
     if(proc->killed)
       exit();
@@ -46,10 +48,13 @@ trap(struct trapframe *tf)
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
+    cpu->ticks++;
+    if(cpu->idle)
+      cpu->idleticks++;
     if(cpu->id == 0){
       acquire(&tickslock);
       ticks++;
-      wakeup(&ticks);
+      twtick();
       release(&tickslock);
     }
     lapiceoi();
@@ -58,6 +63,10 @@ trap(struct trapframe *tf)
     ideintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_WAKEUP:
+    // Only sent to get this cpu out of hlt; see setrunnable.
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE+1:
     // Bochs generates spurious IDE1 interrupts.
     break;
@@ -69,6 +78,23 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_PGFLT:
+    // The first touch of a heap page that sbrk has not backed yet,
+    // or a write to a copy-on-write page.  Either can come from user
+    // space or from the kernel reaching into a user buffer.
+    if(proc){
+      if(!(tf->err & FEC_PR))
+        r = lazyalloc(proc->pgdir, proc->sz, rcr2());
+      else if(tf->err & FEC_WR)
+        r = cowcopy(proc->pgdir, rcr2());
+      else
+        r = -1;
+      if(r == 0){
+        proc->pgfaults++;
+        break;
+      }
+    }
+    goto bad;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
@@ -77,6 +103,7 @@ trap(struct trapframe *tf)
     break;
    
   default:
+  bad:
     if(proc == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
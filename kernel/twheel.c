@@ -0,0 +1,137 @@
+// Hierarchical timing wheel for sleeping processes.
+//
+// A process calling sleep() or sleep_until() parks a struct timer on
+// its kernel stack in the wheel and sleeps on it.  The timer interrupt
+// (see trap.c) calls twtick() once per tick, which wakes only the
+// sleepers whose deadline has arrived, instead of waking every sleeper
+// on every tick to recheck its own deadline.
+//
+// Level 0 has one slot per tick for the next TWSLOTS ticks; each slot
+// of level l covers TWSLOTS^l ticks.  When the level-0 index wraps to
+// 0, the due slot of level 1 is emptied back into the wheel, which
+// spreads its timers over level 0, and so on up the levels.  Deadlines
+// beyond the top level are parked in its farthest slot and re-filed
+// when that slot comes due.
+//
+// The wheel is protected by tickslock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define TWBITS    6
+#define TWSLOTS   (1 << TWBITS)
+#define TWMASK    (TWSLOTS - 1)
+#define TWLEVELS  4
+#define TWSPAN    (1U << (TWBITS * TWLEVELS))  // ticks covered by the wheel
+
+struct timer {
+  uint deadline;          // Value of ticks at which to wake
+  struct timer *next;     // Next timer in the same slot
+  struct timer **pprev;   // Link pointing at us; 0 once fired
+};
+
+static struct timer *wheel[TWLEVELS][TWSLOTS];
+
+// File t in the slot that comes due at its deadline.
+static void
+twadd(struct timer *t)
+{
+  struct timer **slot;
+  uint delta, when;
+  int l;
+
+  delta = t->deadline - ticks;
+  if((int)delta < 0)
+    delta = 0;
+  when = t->deadline;
+  if(delta >= TWSPAN){
+    delta = TWSPAN - (TWSPAN >> TWBITS);
+    when = ticks + delta;
+  }
+  for(l = 0; l < TWLEVELS-1 && delta >= 1U << (TWBITS * (l+1)); l++)
+    ;
+  slot = &wheel[l][(when >> (TWBITS * l)) & TWMASK];
+
+  t->next = *slot;
+  if(t->next)
+    t->next->pprev = &t->next;
+  t->pprev = slot;
+  *slot = t;
+}
+
+// Take t out of the wheel before it fires.
+static void
+twdel(struct timer *t)
+{
+  *t->pprev = t->next;
+  if(t->next)
+    t->next->pprev = t->pprev;
+  t->pprev = 0;
+}
+
+// Empty a slot of an upper level back into the wheel.
+static void
+cascade(int l, int i)
+{
+  struct timer *t, *next;
+
+  t = wheel[l][i];
+  wheel[l][i] = 0;
+  for(; t; t = next){
+    next = t->next;
+    twadd(t);
+  }
+}
+
+// Advance the wheel to the current value of ticks
+// and wake the sleepers that are due.
+// Called once per tick with tickslock held.
+void
+twtick(void)
+{
+  struct timer *t, *next;
+  int l, i;
+
+  if((ticks & TWMASK) == 0){
+    for(l = 1; l < TWLEVELS; l++){
+      i = (ticks >> (TWBITS * l)) & TWMASK;
+      cascade(l, i);
+      if(i != 0)
+        break;
+    }
+  }
+
+  t = wheel[0][ticks & TWMASK];
+  wheel[0][ticks & TWMASK] = 0;
+  for(; t; t = next){
+    next = t->next;
+    t->pprev = 0;
+    wakeup(t);
+  }
+}
+
+// Sleep until ticks reaches deadline.
+// Returns 0, or -1 if the process was killed first.
+// Caller must hold tickslock.
+int
+twsleep(uint deadline)
+{
+  struct timer t;
+
+  if((int)(deadline - ticks) <= 0)
+    return 0;
+  t.deadline = deadline;
+  twadd(&t);
+  while(t.pprev != 0){
+    if(proc->killed){
+      twdel(&t);
+      return -1;
+    }
+    sleep(&t, &tickslock);
+  }
+  return 0;
+}
@@ -59,10 +59,9 @@ walkpgdir(pde_t *pgdir, const void *va, int create)
   if(*pde & PTE_P){
     pgtab = (pte_t*)PTE_ADDR(*pde);
   } else {
-    if(!create || (pgtab = (pte_t*)kalloc()) == 0)
+    if(!create || (pgtab = (pte_t*)kzalloc()) == 0)
       return 0;
-    // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    // kzalloc made sure all those PTE_P bits are zero.
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table 
     // entries, if necessary.
@@ -137,9 +136,8 @@ setupkvm(void)
   pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kzalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
   k = kmap;
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
     if(mappages(pgdir, k->p, k->e - k->p, (uint)k->p, k->perm) < 0)
@@ -157,6 +155,7 @@ vmenable(void)
   switchkvm(); // load kpgdir into cr3
   cr0 = rcr0();
   cr0 |= CR0_PG;
+  cr0 |= CR0_WP;  // kernel writes to copy-on-write pages must fault too
   lcr0(cr0);
 }
 
@@ -193,8 +192,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
   
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pgdir, 0, PGSIZE, PADDR(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -209,6 +207,7 @@ loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
 
   if((uint)addr % PGSIZE != 0)
     panic("loaduvm: addr must be page aligned");
+  ireadahead(ip, offset, sz);
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
       panic("loaduvm: address should exist");
@@ -238,13 +237,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     mappages(pgdir, (char*)a, PGSIZE, PADDR(mem), PTE_W|PTE_U);
   }
   return newsz;
@@ -295,36 +293,116 @@ freevm(pde_t *pgdir)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  The pages themselves are shared
+// copy-on-write: both sides map them read-only with PTE_COW,
+// and the first write from either side makes a private copy
+// (see cowcopy).  pgdir must be the current page table.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
   uint pa, i;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void*)i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    // Heap pages never touched since sbrk are not there yet;
+    // the child will fault them in itself.
+    if((pte = walkpgdir(pgdir, (void*)i, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, PADDR(mem), PTE_W|PTE_U) < 0)
+    if(mappages(d, (void*)i, PGSIZE, pa, PTE_FLAGS(*pte) & ~PTE_P) < 0)
       goto bad;
+    kref((char*)pa);
   }
+  // Flush the parent's now read-only mappings from the TLB.
+  lcr3(PADDR(pgdir));
   return d;
 
 bad:
+  lcr3(PADDR(pgdir));
   freevm(d);
   return 0;
 }
 
+// Handle a fault on a page of the heap that growproc() reserved
+// but did not allocate: back the page containing va with a fresh
+// zeroed page.  Returns 0, or -1 if va is beyond the process size
+// sz or memory is exhausted.
+int
+lazyalloc(pde_t *pgdir, uint sz, uint va)
+{
+  char *mem;
+
+  if(va >= sz || va >= USERTOP)
+    return -1;
+  if((mem = kzalloc()) == 0){
+    cprintf("lazyalloc: out of memory\n");
+    return -1;
+  }
+  if(mappages(pgdir, (char*)PGROUNDDOWN(va), PGSIZE, PADDR(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Count the user pages below sz that are backed by memory.
+// Used for statistics, possibly on another process's page table,
+// so stay away from anything that does not look like a page table.
+int
+uvmresident(pde_t *pgdir, uint sz)
+{
+  pde_t pde;
+  pte_t *pgtab;
+  uint a;
+  int n;
+
+  n = 0;
+  for(a = 0; a < sz && a < USERTOP; a += PGSIZE){
+    pde = pgdir[PDX(a)];
+    if(!(pde & PTE_P) || PTE_ADDR(pde) >= PHYSTOP)
+      continue;
+    pgtab = (pte_t*)PTE_ADDR(pde);
+    if(pgtab[PTX(a)] & PTE_P)
+      n++;
+  }
+  return n;
+}
+
+// Handle a write fault at va in pgdir, which must be the current
+// page table.  If va is on a copy-on-write page, give pgdir its own
+// writable copy (or simply make the page writable, if nobody else
+// shares it any more) and return 0.  Otherwise return -1.
+int
+cowcopy(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa;
+  char *mem;
+
+  if(va >= USERTOP || (pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  if(krefcount((char*)pa) > 1){
+    if((mem = kalloc()) == 0){
+      cprintf("cowcopy: out of memory\n");
+      return -1;
+    }
+    memmove(mem, (char*)pa, PGSIZE);
+    kfree((char*)pa);  // drop our reference to the shared page
+    pa = PADDR(mem);
+  }
+  *pte = pa | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  lcr3(PADDR(pgdir));
+  return 0;
+}
+
 // Map user virtual address to kernel physical address.
 char*
 uva2ka(pde_t *pgdir, char *uva)
@@ -332,7 +410,7 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -13,22 +13,22 @@
 #define dirent xv6_dirent  // avoid clash with host struct stat
 #include "types.h"
 #include "fs.h"
+#include "param.h"
 #include "stat.h"
 #undef stat
 #undef dirent
 
-#define BLOCK_SIZE (512)
-
 int nblocks = 995;
 int ninodes = 200;
 int size = 1024;
 
 int fsfd;
 struct superblock sb;
-char zeroes[512];
+char zeroes[BSIZE];
 uint freeblock;
 uint usedblocks;
 uint bitblocks;
+uint nlog = LOGSIZE+1;  // log header plus log blocks
 uint freeinode = 1;
 uint root_inode;
 
@@ -39,6 +39,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirwrite(uint inum, struct xv6_dirent *ents, int n);
 
 // convert to intel byte order
 ushort
@@ -65,21 +66,27 @@ xint(uint x)
 
 
 int 
-mkfs(int nblocks, int ninodes, int size) {
+mkfs(int ninodes, int size) {
 
   int i;
-  char buf[BLOCK_SIZE];
+  char buf[BSIZE];
+
+  // the metadata takes more or fewer blocks depending on BSIZE;
+  // the rest are data blocks
+  bitblocks = size/BPB + 1;
+  usedblocks = ninodes / IPB + 3 + bitblocks + nlog;
+  freeblock = usedblocks;
+  nblocks = size - usedblocks;
 
   sb.size = xint(size);
-  sb.nblocks = xint(nblocks); // so whole disk is size sectors
+  sb.nblocks = xint(nblocks); // so whole disk is size blocks
   sb.ninodes = xint(ninodes);
+  sb.bsize = xint(BSIZE);
+  sb.nlog = xint(nlog);
+  sb.logstart = xint(ninodes / IPB + 3 + bitblocks);
 
-  bitblocks = size/(512*8) + 1;
-  usedblocks = ninodes / IPB + 3 + bitblocks;
-  freeblock = usedblocks;
-
-  printf("used %d (bit %d ninode %zu) free %u total %d\n", usedblocks,
-         bitblocks, ninodes/IPB + 1, freeblock, nblocks+usedblocks);
+  printf("used %d (bit %d ninode %zu log %u) free %u total %d\n", usedblocks,
+         bitblocks, ninodes/IPB + 1, nlog, freeblock, nblocks+usedblocks);
 
   assert(nblocks + usedblocks == size);
 
@@ -100,25 +107,35 @@ add_dir(DIR *cur_dir, int cur_inode, int parent_inode) {
 	int child_inode;
 	int cur_fd, child_fd;
 	struct xv6_dirent de;
-	struct dinode din;
 	struct dirent dir_buf;
 	struct dirent *entry;
 	struct stat st;
 	int bytes_read;
-	char buf[BLOCK_SIZE];
-	int off;
+	char buf[BSIZE];
+	struct xv6_dirent *ents;
+	int nents;
+
+	// collect the entries, then lay the directory out in one go
+	nents = 0;
+	ents = malloc(2 * sizeof(*ents));
+	if (ents == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
 
-	bzero(&de, sizeof(de));
-	de.inum = xshort(cur_inode);
-	strcpy(de.name, ".");
-	iappend(cur_inode, &de, sizeof(de));
+	bzero(&ents[nents], sizeof(de));
+	ents[nents].inum = xshort(cur_inode);
+	strcpy(ents[nents].name, ".");
+	nents++;
 
-	bzero(&de, sizeof(de));
-	de.inum = xshort(parent_inode);
-	strcpy(de.name, "..");
-	iappend(cur_inode, &de, sizeof(de));
+	bzero(&ents[nents], sizeof(de));
+	ents[nents].inum = xshort(parent_inode);
+	strcpy(ents[nents].name, "..");
+	nents++;
 
 	if (cur_dir == NULL) {
+		dirwrite(cur_inode, ents, nents);
+		free(ents);
 		return 0;
 	}
 
@@ -181,19 +198,103 @@ add_dir(DIR *cur_dir, int cur_inode, int parent_inode) {
 
 		de.inum = xshort(child_inode);
 		strncpy(de.name, entry->d_name, DIRSIZ);
-		iappend(cur_inode, &de, sizeof(de));
+		ents = realloc(ents, (nents + 1) * sizeof(*ents));
+		if (ents == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		ents[nents++] = de;
 
 	}
 
-	// fix size of inode cur_dir
-	rinode(cur_inode, &din);
-	off = xint(din.size);
-	off = ((off/BSIZE) + 1) * BSIZE;
-	din.size = xint(off);
-	winode(cur_inode, &din);
+	dirwrite(cur_inode, ents, nents);
+	free(ents);
 	return 0;
 }
 
+// Hash of a directory entry name; must match dirhash() in kernel/fs.c.
+uint
+dirhash(char *name)
+{
+	uint h;
+	int i;
+
+	h = 0;
+	for (i = 0; i < DIRSIZ && name[i]; i++)
+		h = h*31 + (uchar)name[i];
+	return h;
+}
+
+// Write the n entries of directory inum, "." and ".." first.
+// The root, which every path lookup starts from, and directories
+// too big for DIRHASHMIN blocks are hashed, the way the kernel
+// lays hashed directories out (see fs.h); others are a plain
+// sequence of entries padded to a whole block.
+void
+dirwrite(uint inum, struct xv6_dirent *ents, int n)
+{
+	int slots = BSIZE / sizeof(struct xv6_dirent);
+	char (*blk)[BSIZE];
+	struct xv6_dirent *de;
+	struct dirhead *dh;
+	struct dirnext *dn;
+	struct dinode din;
+	uint off;
+	int nblk, bn, i, j;
+
+	if (inum != root_inode && n <= DIRHASHMIN * slots) {
+		iappend(inum, ents, n * sizeof(*ents));
+
+		// fix size of inode inum
+		rinode(inum, &din);
+		off = xint(din.size);
+		off = ((off/BSIZE) + 1) * BSIZE;
+		din.size = xint(off);
+		winode(inum, &din);
+		return;
+	}
+
+	nblk = 1 + DIRNBUCKET;
+	blk = calloc(nblk, BSIZE);
+	if (blk == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	dh = (struct dirhead*)blk[0];
+	memmove(dh->magic, DIRMAGIC, sizeof(dh->magic));
+	dh->nbucket = xint(DIRNBUCKET);
+	de = (struct xv6_dirent*)blk[0];
+	de[1] = ents[0];
+	de[2] = ents[1];
+
+	for (i = 2; i < n; i++) {
+		bn = 1 + dirhash(ents[i].name) % DIRNBUCKET;
+		for (;;) {
+			de = (struct xv6_dirent*)blk[bn];
+			for (j = 0; j < slots - 1 && de[j].inum != 0; j++)
+				;
+			if (j < slots - 1) {
+				de[j] = ents[i];
+				break;
+			}
+			dn = (struct dirnext*)&de[slots - 1];
+			if (dn->next == 0) {
+				blk = realloc(blk, (nblk + 1) * BSIZE);
+				if (blk == NULL) {
+					perror("realloc");
+					exit(EXIT_FAILURE);
+				}
+				bzero(blk[nblk], BSIZE);
+				dn = (struct dirnext*)((struct xv6_dirent*)blk[bn] + slots - 1);
+				dn->next = xint(nblk++);
+			}
+			bn = xint(dn->next);
+		}
+	}
+	iappend(inum, blk, nblk * BSIZE);
+	free(blk);
+}
+
 
 
 
@@ -208,8 +309,8 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  assert((512 % sizeof(struct dinode)) == 0);
-  assert((512 % sizeof(struct xv6_dirent)) == 0);
+  assert((BSIZE % sizeof(struct dinode)) == 0);
+  assert((BSIZE % sizeof(struct xv6_dirent)) == 0);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -217,7 +318,7 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  mkfs(995, 200, 1024);
+  mkfs(200, 1024);
 
   root_dir = opendir(argv[2]);
 
@@ -237,11 +338,11 @@ main(int argc, char *argv[])
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(write(fsfd, buf, 512) != 512){
+  if(write(fsfd, buf, BSIZE) != BSIZE){
     perror("write");
     exit(1);
   }
@@ -256,7 +357,7 @@ i2b(uint inum)
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -270,7 +371,7 @@ winode(uint inum, struct dinode *ip)
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -283,11 +384,11 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(read(fsfd, buf, 512) != 512){
+  if(read(fsfd, buf, BSIZE) != BSIZE){
     perror("read");
     exit(1);
   }
@@ -300,7 +401,7 @@ ialloc(ushort type)
   struct dinode din;
 
   bzero(&din, sizeof(din));
-  din.type = xshort(type);
+  din.type = xshort(type | DI_EXTENT);
   din.nlink = xshort(1);
   din.size = xint(0);
   winode(inum, &din);
@@ -310,12 +411,12 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[512];
+  uchar buf[BSIZE];
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < 512*8);
-  bzero(buf, 512);
+  assert(used < BPB);
+  bzero(buf, BSIZE);
   for(i = 0; i < used; i++){
     buf[i/8] = buf[i/8] | (0x1 << (i%8));
   }
@@ -325,46 +426,49 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Append n bytes at xp to inode inum.  Blocks are handed out
+// in order, so a file written in one go is a single extent.
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
-  uint fbn, off, n1;
+  uint fbn, off, n1, base;
   struct dinode din;
-  char buf[512];
-  uint indirect[NINDIRECT];
+  struct extent *e;
+  char buf[BSIZE];
   uint x;
+  int i;
 
   rinode(inum, &din);
+  e = (struct extent*)din.addrs;
 
   off = xint(din.size);
   while(n > 0){
-    fbn = off / 512;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-        usedblocks++;
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        // printf("allocate indirect block\n");
-        din.addrs[NDIRECT] = xint(freeblock++);
-        usedblocks++;
+    fbn = off / BSIZE;
+    base = 0;
+    x = 0;
+    for(i = 0; i < NEXTENT && xint(e[i].len) != 0; i++){
+      if(fbn < base + xint(e[i].len)){
+        x = xint(e[i].start) + fbn - base;
+        break;
       }
-      // printf("read indirect block\n");
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        usedblocks++;
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      base += xint(e[i].len);
+    }
+    if(x == 0){
+      assert(fbn == base);
+      x = freeblock++;
+      usedblocks++;
+      if(i > 0 && xint(e[i-1].start) + xint(e[i-1].len) == x)
+        e[i-1].len = xint(xint(e[i-1].len) + 1);
+      else {
+        assert(i < NEXTENT);
+        e[i].start = xint(x);
+        e[i].len = xint(1);
       }
-      x = xint(indirect[fbn-NDIRECT]);
     }
-    n1 = min(n, (fbn + 1) * 512 - off);
+    n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
-    bcopy(p, buf + off - (fbn * 512), n1);
+    bcopy(p, buf + off - (fbn * BSIZE), n1);
     wsect(x, buf);
     n -= n1;
     off += n1;
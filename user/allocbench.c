@@ -0,0 +1,57 @@
+// Page allocator benchmark: several processes fork and sbrk in
+// parallel so that every cpu is allocating and freeing pages at once.
+// usage: allocbench [nprocs] [iterations]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define PGSIZE 4096
+#define NPAGES 16   // pages grown and shrunk per iteration
+
+// Grow the heap by NPAGES pages, touch each one, and give them back.
+// Every so often also fork a child that exits at once.
+void
+worker(int iters)
+{
+  int i, j;
+  char *p;
+
+  for(i = 0; i < iters; i++){
+    p = sbrk(NPAGES*PGSIZE);
+    if(p == (char*)-1){
+      printf(1, "allocbench: sbrk failed\n");
+      exit();
+    }
+    for(j = 0; j < NPAGES; j++)
+      p[j*PGSIZE] = i;
+    sbrk(-NPAGES*PGSIZE);
+    if(i % 8 == 0){
+      if(fork() == 0)
+        exit();
+      wait();
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nprocs, iters, i, start;
+
+  nprocs = argc > 1 ? atoi(argv[1]) : 4;
+  iters = argc > 2 ? atoi(argv[2]) : 500;
+
+  printf(1, "allocbench: %d procs x %d iterations\n", nprocs, iters);
+  start = uptime();
+  for(i = 0; i < nprocs; i++){
+    if(fork() == 0){
+      worker(iters);
+      exit();
+    }
+  }
+  for(i = 0; i < nprocs; i++)
+    wait();
+  printf(1, "allocbench: %d ticks\n", uptime() - start);
+  exit();
+}
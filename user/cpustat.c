@@ -0,0 +1,24 @@
+#include "types.h"
+#include "cpustat.h"
+#include "user.h"
+
+//this program displays how much of its time each cpu has spent idle (halted with nothing to run)
+int main(int argc, char* argv[]) {
+	struct cpustat st; 		//the per-cpu statistics
+	int i;
+
+	if (getcpuinfo(&st) < 0) {
+		printf(2, "cpustat: getcpuinfo failed\n");
+		exit();
+	}
+	printf(1," cpu | ticks | idle | idle%%\n");
+	for (i = 0; i < st.ncpu; i++) { 	//for-each cpu
+		printf(1, "  %d  |  %d  |  %d  |  %d\n",
+			i,
+			st.ticks[i],
+			st.idleticks[i],
+			st.ticks[i] ? st.idleticks[i] * 100 / st.ticks[i] : 0
+		);
+	}
+	exit(); 	//exit the process
+}
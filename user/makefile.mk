@@ -18,6 +18,10 @@ USER_PROGS := \
 	zombie\
 	ps\
 	tickettest\
+	mtickettest\
+	cpustat\
+	allocbench\
+	sync\
 
 USER_PROGS := $(addprefix user/, $(USER_PROGS))
 
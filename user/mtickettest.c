@@ -0,0 +1,81 @@
+#include "pstat.h"
+#include "user.h"
+//multi-CPU version of tickettest: spawn several sets of spinning
+//processes holding 10,20,30,40, & 50 tickets, let them compete across
+//all of the CPUs for a while, then compare the share of the cpu each
+//ticket level received with the share its tickets entitle it to.
+//usage: mtickettest [sets] [ticks]
+
+#define LEVELS 5
+
+int main(int argc, char *argv[]) {
+	int sets = 2; 		//default to one set per cpu on the default 2-cpu qemu
+	int duration = 1000; 	//how long to let the children run (ticks)
+	int pids[NPROC];
+	int nchild = 0;
+	int levelTicks[LEVELS+1];
+	int total = 0;
+	int i, j, pid;
+	struct pstat table;
+
+	if (argc > 1) sets = atoi(argv[1]);
+	if (argc > 2) duration = atoi(argv[2]);
+	if (sets < 1 || sets * LEVELS > NPROC / 2) {
+		printf(2, "mtickettest: bad number of sets\n");
+		exit();
+	}
+	settickets(1000); 	//so the parent gets to sleep and collect results promptly
+
+	for (i = 0; i < sets; i++) {
+		for (j = 1; j <= LEVELS; j++) {
+			settickets(j * 10); 	//child inherits its share from its first tick
+			pid = fork();
+			if (pid < 0) {
+				printf(2, "<fork failed>\n");
+				break;
+			}
+			if (pid == 0) { //child: spin forever with j*10 tickets
+				for (;;)
+					;
+			}
+			pids[nchild++] = pid;
+		}
+	}
+	settickets(1000);
+
+	sleep(duration);
+	getpinfo(&table);
+
+	//sum up the ticks each ticket level received
+	for (j = 0; j <= LEVELS; j++)
+		levelTicks[j] = 0;
+	for (i = 0; i < NPROC; i++) {
+		if (!table.inuse[i])
+			continue;
+		for (j = 0; j < nchild; j++) {
+			if (table.pid[i] == pids[j]) {
+				levelTicks[table.tickets[i] / 10] += table.ticks[i];
+				total += table.ticks[i];
+			}
+		}
+	}
+
+	for (j = 0; j < nchild; j++)
+		kill(pids[j]);
+	for (j = 0; j < nchild; j++)
+		wait();
+
+	if (total == 0) {
+		printf(2, "mtickettest: children never ran\n");
+		exit();
+	}
+	printf(1, "tickets | ticks | share%% | expected%%\n");
+	for (j = 1; j <= LEVELS; j++)
+		printf(1, "   %d   |  %d  |   %d   |   %d\n",
+			j * 10,
+			levelTicks[j],
+			levelTicks[j] * 100 / total,
+			j * 10 * 100 / 150 	//10+20+30+40+50 = 150 tickets per set
+		);
+	exit();
+}
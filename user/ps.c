@@ -1,21 +1,25 @@
 #include "pstat.h"
 #include "user.h"
 
-void print_as_table(int inuse, int pid, int tickets, int ticks) {
-	printf(1, "   %d  |   %d  |   %d   |  %d\n",
+void print_as_table(int inuse, int pid, int tickets, int ticks, int faults, int resident) {
+	printf(1, "   %d  |   %d  |   %d   |  %d  |  %d  |  %d\n",
 		inuse,
 		pid,
 		tickets,
-		ticks
+		ticks,
+		faults,
+		resident
 	);
 }
 
-void print_as_csv(int inuse, int pid, int tickets, int ticks) {
-	printf(1, "%d,%d,%d,%d\n",
+void print_as_csv(int inuse, int pid, int tickets, int ticks, int faults, int resident) {
+	printf(1, "%d,%d,%d,%d,%d,%d\n",
 		inuse,
 		pid,
 		tickets,
-		ticks
+		ticks,
+		faults,
+		resident
 	);
 }
 
@@ -27,7 +31,8 @@ int main(int argc, char* argv[]) {
 	struct pstat table; 		//the table holding the process stats
 	getpinfo(&table); 		//load the table
 	//print the table data
-	printf(1," used | pid  |tickets| ticks\n");
+	if (!csv_flag) printf(1,"scheduler: %s\n", table.policy == SCHED_STRIDE ? "stride" : "lottery");
+	printf(1," used | pid  |tickets| ticks | faults | pages\n");
 	for (uint index = 0; index < NPROC; index++) { 	//for-each process
 		int a = (table.inuse[index] 	!= 0); 	//if the program is in use
 		int b = (table.pid[index] 	!= 0); 	//if the pid is not 0
@@ -39,13 +44,17 @@ int main(int argc, char* argv[]) {
 					table.inuse[index],
 					table.pid[index],
 					table.tickets[index],
-					table.ticks[index]
+					table.ticks[index],
+					table.faults[index],
+					table.resident[index]
 				);
 			else print_as_table( 		//if csv_flag is not set, print in a tabular format
 					table.inuse[index],
 					table.pid[index],
 					table.tickets[index],
-					table.ticks[index]
+					table.ticks[index],
+					table.faults[index],
+					table.resident[index]
 				);
 				
 		}
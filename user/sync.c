@@ -0,0 +1,11 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Write all delayed disk writes out now.
+int
+main(int argc, char **argv)
+{
+  sync();
+  exit();
+}
@@ -3,6 +3,7 @@
 #include "types.h" // without this include, it compiles with a plethora of errors, all referring to 'uint' not being defined.
 struct stat;
 struct pstat;
+struct cpustat;
 
 // system calls
 int fork(void);
@@ -25,10 +26,14 @@ int dup(int);
 int getpid(void);
 char* sbrk(int);
 int sleep(int);
+int sleep_until(uint);
 int uptime(void);
 int cluis(void);
 int settickets(uint);
 int getpinfo(struct pstat*);
+int getcpuinfo(struct cpustat*);
+int sync(void);
+int fsync(int);
 
 // user library functions (ulib.c)
 int stat(char*, struct stat*);